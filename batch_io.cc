@@ -0,0 +1,217 @@
+#include "batch_io.h"
+#include "utils.h"
+// C headers
+#include <cerrno>
+#include <cstring>
+#include <cstdint>
+// C++ headers
+#include <algorithm>
+// LINUX headers
+#include <netinet/udp.h>
+
+// limits of the kernel for one segmented/coalesced datagram
+static const int MAX_SEGMENTS = 64;
+static const int MAX_DATAGRAM_SIZE = 65507;
+static const size_t CONTROL_SIZE = CMSG_SPACE(sizeof(int));
+
+PacketBatch::PacketBatch(int capacity, int max_packet_size) : segment_size(max_packet_size), 
+    slot_size(max_packet_size), count(0), gso(false), gro(false),
+    buffers((size_t) capacity * max_packet_size), controls(capacity * CONTROL_SIZE),
+    names(capacity), iovs(capacity), msgs(capacity), firsts(capacity) {
+    memset(msgs.data(), 0, sizeof(struct mmsghdr) * capacity);
+    for (int i = 0; i != capacity; ++i) {
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &names[i];
+    }
+    allocate(capacity);
+}
+
+void PacketBatch::allocate(int packets) {
+    datas.resize(packets);
+    lengths.resize(packets);
+    addrs.resize(packets);
+}
+
+char* PacketBatch::control(int idx) {
+    return controls.data() + idx * CONTROL_SIZE;
+}
+
+bool PacketBatch::enable_gso(int sockfd) {
+    // the option can be read if the kernel supports segmentation
+    int size = 0;
+    socklen_t len = sizeof(size);
+    if (getsockopt(sockfd, SOL_UDP, UDP_SEGMENT, &size, &len) == -1) {
+        return false;
+    }
+    gso = true;
+    return true;
+}
+
+bool PacketBatch::enable_gro(int sockfd) {
+    int on = 1;
+    if (setsockopt(sockfd, SOL_UDP, UDP_GRO, &on, sizeof(on)) == -1) {
+        return false;
+    }
+    gro = true;
+    // every datagram may hold up to MAX_SEGMENTS packets
+    slot_size = MAX_DATAGRAM_SIZE;
+    buffers.resize((size_t) capacity() * slot_size);
+    allocate(capacity() * MAX_SEGMENTS);
+    return true;
+}
+
+void PacketBatch::set_segment_size(int size) {
+    segment_size = size;
+    if (!gro) {
+        slot_size = size;
+    }
+}
+
+void PacketBatch::push(const struct sockaddr_in& addr, int length) {
+    datas[count] = slot(count);
+    lengths[count] = length;
+    addrs[count] = addr;
+    ++count;
+}
+
+void PacketBatch::push(const struct sockaddr_in& addr, const char* packet, int length) {
+    memcpy(next(), packet, length);
+    push(addr, length);
+}
+
+static bool same_addr(const struct sockaddr_in& lhs, const struct sockaddr_in& rhs) {
+    return lhs.sin_addr.s_addr == rhs.sin_addr.s_addr && lhs.sin_port == rhs.sin_port;
+}
+
+// fill msgs with packets starting from `first`, returns the number of datagrams
+int PacketBatch::build_datagrams(int first) {
+    int m = 0;
+    for (int i = first; i < count; ++m) {
+        int j = i + 1;
+        int bytes = lengths[i];
+        if (gso) {
+            // every packet of a segmented datagram but the last one has the full size
+            while (j < count && j - i < MAX_SEGMENTS && lengths[j-1] == segment_size
+                    && bytes + lengths[j] <= MAX_DATAGRAM_SIZE && same_addr(addrs[i], addrs[j])) {
+                bytes += lengths[j];
+                ++j;
+            }
+        }
+        struct msghdr& hdr = msgs[m].msg_hdr;
+        names[m] = addrs[i];
+        hdr.msg_namelen = sizeof(struct sockaddr_in);
+        iovs[m].iov_base = datas[i];
+        iovs[m].iov_len = bytes;
+        if (j - i > 1) {
+            hdr.msg_control = control(m);
+            hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+            cmsg->cmsg_level = SOL_UDP;
+            cmsg->cmsg_type = UDP_SEGMENT;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+            uint16_t size = segment_size;
+            memcpy(CMSG_DATA(cmsg), &size, sizeof(size));
+        }
+        else {
+            hdr.msg_control = NULL;
+            hdr.msg_controllen = 0;
+        }
+        firsts[m] = i;
+        i = j;
+    }
+    return m;
+}
+
+int PacketBatch::send(int sockfd) {
+    int first = 0;
+    while (first != count) {
+        int datagrams = build_datagrams(first);
+        // sendmmsg may stop early, e.g. when interrupted
+        int sent = 0;
+        while (sent != datagrams) {
+            int n = sendmmsg(sockfd, msgs.data() + sent, datagrams - sent, 0);
+            if (n >= 0) {
+                sent += n;
+            }
+            else if (errno == EINTR) {
+                continue;
+            }
+            else if (gso && (errno == EIO || errno == EINVAL || errno == EOPNOTSUPP)) {
+                // no segmentation on this path, send the rest one by one
+                print_sys_error("UDP GSO unavailable, sending without segmentation");
+                gso = false;
+                break;
+            }
+            else {
+                count = 0;
+                return -1;
+            }
+        }
+        first = sent == datagrams ? count : firsts[sent];
+    }
+    int packets = count;
+    count = 0;
+    return packets;
+}
+
+int PacketBatch::send(Transport& transport) {
+    if (transport.batched()) {
+        return send(transport.fd());
+    }
+    for (int i = 0; i != count; ++i) {
+        int n;
+        do {
+            n = transport.send(addrs[i], datas[i], lengths[i]);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) {
+            count = 0;
+            return -1;
+        }
+    }
+    int packets = count;
+    count = 0;
+    return packets;
+}
+
+int PacketBatch::recv(int sockfd, int flags) {
+    for (int i = 0; i != capacity(); ++i) {
+        struct msghdr& hdr = msgs[i].msg_hdr;
+        iovs[i].iov_base = slot(i);
+        iovs[i].iov_len = slot_size;
+        hdr.msg_namelen = sizeof(struct sockaddr_in);
+        hdr.msg_control = gro ? control(i) : NULL;
+        hdr.msg_controllen = gro ? CONTROL_SIZE : 0;
+    }
+    count = 0;
+    int n = recvmmsg(sockfd, msgs.data(), capacity(), flags, NULL);
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+    for (int i = 0; i != n; ++i) {
+        int length = msgs[i].msg_len;
+        int gro_size = length;
+        if (gro) {
+            struct msghdr& hdr = msgs[i].msg_hdr;
+            for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != NULL;
+                    cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+                if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+                    memcpy(&gro_size, CMSG_DATA(cmsg), sizeof(gro_size));
+                }
+            }
+            if (gro_size <= 0) {
+                gro_size = length;
+            }
+        }
+        // split a coalesced datagram back into packets
+        int offset = 0;
+        do {
+            datas[count] = slot(i) + offset;
+            lengths[count] = std::min(gro_size, length - offset);
+            addrs[count] = names[i];
+            ++count;
+            offset += gro_size;
+        } while (offset < length);
+    }
+    return count;
+}
@@ -0,0 +1,98 @@
+#ifndef _BATCH_IO_H_
+#define _BATCH_IO_H_
+
+#include "transport.h"
+
+#include <vector>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+// A batch of datagrams sent with one sendmmsg or received with one recvmmsg. Packet buffers,
+// addresses and the iovec/mmsghdr arrays are allocated once, in the constructor.
+//
+// With UDP GSO, runs of full-size packets to the same address (which are contiguous in the
+// batch buffer) are handed to the kernel as one message and segmented there. With UDP GRO,
+// the kernel may coalesce received datagrams, which are split back into packets here.
+class PacketBatch {
+public:
+    PacketBatch(int capacity, int max_packet_size);
+
+    PacketBatch(const PacketBatch&) = delete;
+
+    PacketBatch& operator=(const PacketBatch&) = delete;
+
+    // segment outgoing packets in the kernel, false if the socket does not support it
+    bool enable_gso(int sockfd);
+
+    // accept coalesced datagrams, false if the socket does not support it
+    bool enable_gro(int sockfd);
+
+    // size of full outgoing packets (max_packet_size by default), which are built next to 
+    // each other so that the kernel can segment them, call while the batch is empty
+    void set_segment_size(int size);
+
+    int capacity() const { return (int) msgs.size(); }
+
+    int size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    bool full() const { return count == capacity(); }
+
+    void clear() { count = 0; }
+
+    // buffer of the next packet to send, build the packet in place then call push()
+    char* next() { return slot(count); }
+
+    void push(const struct sockaddr_in& addr, int length);
+
+    // copy a built packet into the batch
+    void push(const struct sockaddr_in& addr, const char* packet, int length);
+
+    // send all packets, returns -1 if the socket fails before the whole batch is sent
+    int send(int sockfd);
+
+    // send all packets through the transport, one by one if it doesn't take batches
+    int send(Transport& transport);
+
+    // receive up to capacity() datagrams, returns the number of packets received (0 if none
+    // is waiting with MSG_DONTWAIT) or -1 on error
+    int recv(int sockfd, int flags);
+
+    char* data(int idx) { return datas[idx]; }
+
+    int length(int idx) const { return lengths[idx]; }
+
+    const struct sockaddr_in& addr(int idx) const { return addrs[idx]; }
+
+private:
+    int segment_size;
+    int slot_size; // max_packet_size, or the largest datagram with GRO
+    int count;
+    bool gso;
+    bool gro;
+    std::vector<char> buffers;
+    std::vector<char> controls; // one UDP_SEGMENT/UDP_GRO control message per datagram
+
+    // packets
+    std::vector<char*> datas;
+    std::vector<int> lengths;
+    std::vector<struct sockaddr_in> addrs;
+
+    // datagrams
+    std::vector<struct sockaddr_in> names;
+    std::vector<struct iovec> iovs;
+    std::vector<struct mmsghdr> msgs;
+    std::vector<int> firsts; // first packet of each datagram
+
+    char* slot(int idx) { return buffers.data() + (size_t) idx * slot_size; }
+
+    char* control(int idx);
+
+    void allocate(int packets);
+
+    int build_datagrams(int first);
+};
+
+#endif
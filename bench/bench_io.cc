@@ -0,0 +1,122 @@
+// Datagram throughput on loopback: one sendto/recvfrom per packet versus sendmmsg/recvmmsg
+// batches, i.e. the I/O paths of Client/Server before and after batching.
+//
+// usage: ./bench_io [PACKETS] [PACKET_SIZE] [BATCH]
+
+// project headers
+#include "batch_io.h"
+#include "utils.h"
+// C++ headers
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+// C headers
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+// LINUX headers
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+    double send_pps;
+    double recv_pps;
+    long received;
+};
+
+static int bound_socket(struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    bind(fd, (const struct sockaddr*) &addr, sizeof(addr));
+    socklen_t len = sizeof(addr);
+    getsockname(fd, (struct sockaddr*) &addr, &len);
+    return fd;
+}
+
+static Result run(long packets, int packet_size, int batch) {
+    struct sockaddr_in addr;
+    int recv_fd = bound_socket(addr);
+    int send_fd = socket(AF_INET, SOCK_DGRAM, 0);
+    Transport transport(send_fd);
+    std::atomic<bool> done(false);
+    long received = 0;
+    Clock::time_point first, last;
+
+    std::thread receiver([&]() {
+        PacketBatch in(batch, packet_size);
+        struct pollfd fd = {recv_fd, POLLIN, 0};
+        for (;;) {
+            if (poll(&fd, 1, 200) == 0) {
+                if (done) break;
+                continue;
+            }
+            long n = 0;
+            if (batch == 1) {
+                struct sockaddr_in from;
+                std::vector<char> packet(packet_size);
+                n = recv_packet(recv_fd, from, packet.data(), packet_size) >= 0 ? 1 : 0;
+            }
+            else {
+                n = in.recv(recv_fd, MSG_DONTWAIT);
+            }
+            if (received == 0) first = Clock::now();
+            received += n;
+            last = Clock::now();
+        }
+    });
+
+    PacketBatch out(batch, packet_size);
+    std::vector<char> packet(packet_size, 'x');
+    Clock::time_point start = Clock::now();
+    for (long i = 0; i < packets;) {
+        if (batch == 1) {
+            send_packet(transport, addr, packet.data(), packet.size());
+            i += 1;
+        }
+        else {
+            while (!out.full() && i + out.size() < packets) {
+                out.push(addr, packet.data(), packet_size);
+            }
+            i += out.size();
+            out.send(send_fd);
+        }
+    }
+    double send_sec = std::chrono::duration<double>(Clock::now() - start).count();
+    done = true;
+    receiver.join();
+    close(send_fd);
+    close(recv_fd);
+
+    Result result;
+    result.send_pps = packets / send_sec;
+    double recv_sec = std::chrono::duration<double>(last - first).count();
+    result.recv_pps = recv_sec > 0 ? received / recv_sec : 0;
+    result.received = received;
+    return result;
+}
+
+int main(int argc, char** argv) {
+    long packets = argc > 1 ? std::atol(argv[1]) : 200000;
+    int packet_size = argc > 2 ? std::atoi(argv[2]) : 524;
+    int batch = argc > 3 ? std::atoi(argv[3]) : 32;
+
+    Result before = run(packets, packet_size, 1);
+    Result after = run(packets, packet_size, batch);
+    printf("{\"packets\": %ld, \"packet_size\": %d, \"batch\": %d,\n", packets, packet_size, batch);
+    printf(" \"sendto\":   {\"send_pps\": %.0f, \"recv_pps\": %.0f, \"received\": %ld},\n", 
+            before.send_pps, before.recv_pps, before.received);
+    printf(" \"sendmmsg\": {\"send_pps\": %.0f, \"recv_pps\": %.0f, \"received\": %ld}}\n", 
+            after.send_pps, after.recv_pps, after.received);
+    return 0;
+}
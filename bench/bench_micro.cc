@@ -0,0 +1,713 @@
+// Microbenchmarks of the per-packet hot paths, one function at a time:
+//   reassembly/*  the receiver path of Server::recv_data_to_buffer (store_data_packet) on a
+//                 session, for several arrival patterns, with and without checksums
+//   sack/*        SACK blocks of a buffer with holes, encoded and decoded
+//   packetize/*   data packets built in place from the file, as Client::write_data_packet
+//   header/*      header codec of both layouts
+//   socket/*      send_packet + recv_packet, and batches of 32, over a pair of loopback
+//                 UDP sockets
+//   log/*         print_log to stdout (/dev/null) and to the binary event log
+//   fec/*         GF(2^8) multiply-add of each kernel, parity of a block and its decoding
+//   checksum/*    CRC32C of each kernel, packets sealed and verified, digest extended
+// Each benchmark grows its iteration count until a run takes --min-time, like Google
+// Benchmark, and reports the time per iteration (one packet unless the name says otherwise).
+//
+// usage: ./bench_micro [FILTER] [--min-time=MS] [--json]
+// build it optimized: make clean && make bench_micro CFLAGS="-I. -O2 -DNDEBUG"
+
+// project headers
+#include "ring_buffer.h"
+#include "server.h"
+#include "file_reader.h"
+#include "batch_io.h"
+#include "transport.h"
+#include "event_log.h"
+#include "packet.h"
+#include "fec.h"
+#include "checksum.h"
+#include "utils.h"
+// C++ headers
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+// C headers
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+// LINUX headers
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+typedef std::chrono::steady_clock Clock;
+
+// keep the compiler from dropping a computation whose result is unused
+static void keep(const void* value) {
+    asm volatile("" : : "g"(value) : "memory");
+}
+
+struct Benchmark {
+    std::string name;
+    long bytes; // processed per iteration, 0 if throughput doesn't apply
+    std::function<void(long)> body; // runs the given number of iterations
+};
+
+struct Result {
+    std::string name;
+    long iterations;
+    double ns_per_iteration;
+    double bytes_per_second;
+};
+
+static Result run_benchmark(const Benchmark& benchmark, double min_time) {
+    long iterations = 1;
+    for (;;) {
+        Clock::time_point start = Clock::now();
+        benchmark.body(iterations);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        if (seconds >= min_time || iterations >= (LONG_MAX >> 2)) {
+            Result result;
+            result.name = benchmark.name;
+            result.iterations = iterations;
+            result.ns_per_iteration = seconds * 1e9 / iterations;
+            result.bytes_per_second = benchmark.bytes * iterations / seconds;
+            return result;
+        }
+        // aim a little past min_time with the next run
+        double scale = seconds > 0 ? 1.4 * min_time / seconds : 100;
+        iterations = std::max(iterations + 1, (long) (iterations * std::min(scale, 100.0)));
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// reassembly
+
+const int REASSEMBLY_WINDOW = 2048;   // slots of the receive buffer
+const int REASSEMBLY_PACKETS = 1 << 16; // packets of one pattern, which then repeats
+
+// a session of 32-bit sequence numbers fed through store_data_packet, the receive path of 
+// Server::recv_data_to_buffer without the ACKs: in-order packets are written out with the 
+// packets behind them (pwritev to /dev/null), the others wait in the buffer; with checksums
+// the digest of the file is extended as the server does
+class Reassembly {
+public:
+    Reassembly(int segment, bool checksum) : segment(segment), 
+        session(REASSEMBLY_WINDOW, segment, checksum ? PACKED_VERSION : SEQ32_VERSION, 
+                SeqSpace(SEQ32_SPACE), RttEstimator(500000, 10000, 60000000)),
+        packet(PACKED_HEADER_SIZE + CHECKSUM_OPTION_SIZE + HEADER_SIZE + segment, 'x'), 
+        payload_crc(0) {
+        session.checksum = checksum;
+        session.expect_seq_number = 0;
+        session.buffer.reset(0);
+        session.filefd = open("/dev/null", O_WRONLY);
+        session.file_offset = 0;
+        HeaderView header(packet.data());
+        header.reset(session.version);
+        if (checksum) {
+            session.slot_shift.reset(new Crc32cShift(segment));
+            HeaderOptions header_options;
+            header_options.checksum = true;
+            header.set_options_length(encode_header_options(header_options, 
+                        header.options()));
+            payload_crc = crc32c(0, header.payload(), segment);
+        }
+        length = header.size() + segment;
+    }
+
+    ~Reassembly() { close(session.filefd); }
+
+    void receive(uint64_t packet_idx) {
+        HeaderView header(packet.data());
+        header.set_seq_number(session.seq_space.add(0, packet_idx * segment));
+        store_data_packet(session, packet.data(), length, header, payload_crc);
+    }
+
+    const Session& state() const { return session; }
+
+private:
+    int segment;
+    Session session;
+    std::vector<char> packet; // the same payload at every sequence number
+    int length;
+    uint32_t payload_crc;
+};
+
+// arrival order of the packets 0..REASSEMBLY_PACKETS-1, every packet arrives at least once
+static std::vector<int> arrival_order(const std::string& pattern) {
+    std::mt19937 random(1);
+    std::vector<int> order;
+    if (pattern == "in_order") {
+        for (int i = 0; i != REASSEMBLY_PACKETS; ++i) {
+            order.push_back(i);
+        }
+    }
+    else if (pattern == "loss_1pct" || pattern == "loss_5pct") {
+        // a lost packet is retransmitted one window later (before the window moves past it)
+        int percent = pattern == "loss_1pct" ? 1 : 5;
+        std::vector<int> lost;
+        for (int i = 0; i != REASSEMBLY_PACKETS; ++i) {
+            if ((int) (random() % 100) < percent) {
+                lost.push_back(i);
+            }
+            else {
+                order.push_back(i);
+            }
+            while (!lost.empty() && (i - lost.front() >= REASSEMBLY_WINDOW / 2
+                        || i == REASSEMBLY_PACKETS - 1)) {
+                order.push_back(lost.front());
+                lost.erase(lost.begin());
+            }
+        }
+    }
+    else if (pattern == "reorder_10pct") {
+        // a packet overtakes the next one
+        for (int i = 0; i != REASSEMBLY_PACKETS; ++i) {
+            order.push_back(i);
+        }
+        for (int i = 0; i + 1 < REASSEMBLY_PACKETS; ++i) {
+            if (random() % 10 == 0) {
+                std::swap(order[i], order[i + 1]);
+                ++i;
+            }
+        }
+    }
+    else if (pattern == "reverse_window") {
+        // every window arrives backwards, the worst case of the buffer
+        for (int base = 0; base < REASSEMBLY_PACKETS; base += REASSEMBLY_WINDOW) {
+            for (int i = REASSEMBLY_WINDOW - 1; i >= 0; --i) {
+                order.push_back(base + i);
+            }
+        }
+    }
+    else if (pattern == "duplicates") {
+        // every packet arrives twice, as with spurious retransmissions
+        for (int i = 0; i != REASSEMBLY_PACKETS; ++i) {
+            order.push_back(i);
+            order.push_back(std::max(i - 8, 0));
+        }
+    }
+    return order;
+}
+
+static void add_reassembly(std::vector<Benchmark>& benchmarks) {
+    const char* patterns[] = {"in_order", "loss_1pct", "loss_5pct", "reorder_10pct",
+        "reverse_window", "duplicates"};
+    for (const char* pattern : patterns) {
+        std::vector<int> order = arrival_order(pattern);
+        for (int segment : {BASE_SEGMENT_SIZE, 8960}) {
+            for (bool checksum : {false, true}) {
+                Benchmark benchmark;
+                benchmark.name = std::string("reassembly/") + pattern + "/"
+                    + std::to_string(segment) + (checksum ? "/checksum" : "");
+                benchmark.bytes = (long) segment * REASSEMBLY_PACKETS / order.size();
+                benchmark.body = [order, segment, checksum](long iterations) {
+                    Reassembly reassembly(segment, checksum);
+                    uint64_t round = 0;
+                    size_t next = 0;
+                    for (long i = 0; i != iterations; ++i) {
+                        reassembly.receive(round * REASSEMBLY_PACKETS + order[next]);
+                        if (++next == order.size()) {
+                            next = 0;
+                            ++round;
+                        }
+                    }
+                    keep(&reassembly.state());
+                };
+                benchmarks.push_back(benchmark);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// SACK blocks
+
+static void add_sack(std::vector<Benchmark>& benchmarks) {
+    // every 8th packet of the window is missing
+    auto fill = [](RingBuffer& buffer) {
+        std::vector<char> payload(BASE_SEGMENT_SIZE, 'x');
+        for (int i = 1; i != buffer.capacity(); ++i) {
+            if (i % 8 != 0) {
+                buffer.insert(i * BASE_SEGMENT_SIZE, payload.data(), BASE_SEGMENT_SIZE);
+            }
+        }
+    };
+    benchmarks.push_back({"sack/received_ranges", 0, [fill](long iterations) {
+        RingBuffer buffer(REASSEMBLY_WINDOW, BASE_SEGMENT_SIZE, SeqSpace(SEQ32_SPACE));
+        buffer.reset(0);
+        fill(buffer);
+        SackBlock blocks[MAX_SACK_BLOCKS];
+        for (long i = 0; i != iterations; ++i) {
+            keep(blocks);
+            int count = buffer.received_ranges(blocks, MAX_SACK_BLOCKS);
+            keep(&count);
+        }
+    }});
+    benchmarks.push_back({"sack/encode_decode", 0, [](long iterations) {
+        SackBlock blocks[MAX_SACK_BLOCKS];
+        for (int i = 0; i != MAX_SACK_BLOCKS; ++i) {
+            blocks[i].start = i * 8 * BASE_SEGMENT_SIZE;
+            blocks[i].end = blocks[i].start + 7 * BASE_SEGMENT_SIZE;
+        }
+        char payload[1 + MAX_SACK_BLOCKS * 8];
+        SackBlock decoded[MAX_SACK_BLOCKS];
+        for (long i = 0; i != iterations; ++i) {
+            keep(blocks);
+            int length = encode_sack_blocks(blocks, MAX_SACK_BLOCKS, payload);
+            int count = decode_sack_blocks(payload, length, decoded);
+            keep(decoded);
+            keep(&count);
+        }
+    }});
+}
+
+// ---------------------------------------------------------------------------------------
+// packetization
+
+const size_t PACKETIZE_FILE_SIZE = 64 << 20;
+
+// Client::write_data_packet: the header is built in place, then the payload is read from
+// the file right behind it
+static void add_packetize(std::vector<Benchmark>& benchmarks, const std::string& path) {
+    struct Mode {
+        const char* name;
+        FileReadMode read_mode;
+    };
+    const Mode modes[] = {{"mmap", READ_MMAP}, {"chunk", READ_CHUNK}};
+    for (const Mode& mode : modes) {
+        for (uint8_t version : {SEQ32_VERSION, PACKED_VERSION}) {
+            for (int segment : {BASE_SEGMENT_SIZE, 1460, 8960}) {
+                Benchmark benchmark;
+                benchmark.name = std::string("packetize/") + mode.name + "/"
+                    + (version == PACKED_VERSION ? "packed" : "seq32") + "/"
+                    + std::to_string(segment);
+                benchmark.bytes = segment;
+                FileReadMode read_mode = mode.read_mode;
+                benchmark.body = [path, read_mode, version, segment](long iterations) {
+                    FileReader file;
+                    if (file.open(path, read_mode, 1 << 20) == -1) {
+                        print_sys_error("Cannot open benchmark file");
+                        exit(EXIT_FAILURE);
+                    }
+                    SeqSpace seq_space(SEQ32_SPACE);
+                    size_t packets = file.size() / segment;
+                    std::vector<char> packet(PACKED_HEADER_SIZE + HEADER_SIZE + segment);
+                    for (long i = 0; i != iterations; ++i) {
+                        size_t offset = (i % packets) * segment;
+                        HeaderView header(packet.data());
+                        header.reset(version);
+                        header.set_seq_number(seq_space.add(12345, offset));
+                        header.set_ack_number(54321);
+                        header.set_ack(true);
+                        file.read(offset, header.payload(), segment);
+                        keep(packet.data());
+                    }
+                    file.close();
+                };
+                benchmarks.push_back(benchmark);
+            }
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// header codec
+
+static void add_header(std::vector<Benchmark>& benchmarks) {
+    for (uint8_t version : {SEQ32_VERSION, PACKED_VERSION}) {
+        std::string layout = version == PACKED_VERSION ? "packed" : "seq32";
+        benchmarks.push_back({"header/build/" + layout, 0, [version](long iterations) {
+            char packet[HEADER_SIZE];
+            for (long i = 0; i != iterations; ++i) {
+                HeaderView header(packet);
+                header.reset(version);
+                header.set_seq_number((uint32_t) i);
+                header.set_ack_number((uint32_t) i + 1);
+                header.set_ack(true);
+                keep(packet);
+            }
+        }});
+        benchmarks.push_back({"header/parse/" + layout, 0, [version](long iterations) {
+            char packet[HEADER_SIZE];
+            HeaderView header(packet);
+            header.reset(version);
+            header.set_seq_number(123456789);
+            header.set_ack_number(987654321);
+            header.set_ack(true);
+            uint32_t sum = 0;
+            for (long i = 0; i != iterations; ++i) {
+                keep(packet);
+                ConstHeaderView in_header(packet);
+                if (header_complete(packet, sizeof(packet)) && in_header.ack()) {
+                    sum += in_header.seq_number() + in_header.ack_number() + in_header.size();
+                }
+            }
+            keep(&sum);
+        }});
+    }
+    benchmarks.push_back({"header/encode_decode_struct", 0, [](long iterations) {
+        char packet[HEADER_SIZE];
+        Header header = {123456789, 987654321, true, false, false, SEQ32_VERSION};
+        Header decoded;
+        for (long i = 0; i != iterations; ++i) {
+            keep(&header);
+            encode_header(header, packet);
+            decode_header(packet, decoded);
+            keep(&decoded);
+        }
+    }});
+}
+
+// ---------------------------------------------------------------------------------------
+// socket
+
+static int loopback_socket(struct sockaddr_in& addr) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int size = 8 << 20;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) == -1
+            || getsockname(fd, (struct sockaddr*) &addr, &len) == -1) {
+        print_sys_error("Cannot bind loopback socket");
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+static void add_socket(std::vector<Benchmark>& benchmarks) {
+    for (int size : {HEADER_SIZE + BASE_SEGMENT_SIZE, PACKED_HEADER_SIZE + 8960}) {
+        // one packet sent and received by the same thread
+        benchmarks.push_back({"socket/send_recv_packet/" + std::to_string(size), size,
+                [size](long iterations) {
+            struct sockaddr_in send_addr, recv_addr, from;
+            int send_fd = loopback_socket(send_addr);
+            int recv_fd = loopback_socket(recv_addr);
+            Transport transport(send_fd);
+            std::vector<char> packet(size, 0), in_packet(size);
+            for (long i = 0; i != iterations; ++i) {
+                send_packet(transport, recv_addr, packet.data(), size);
+                recv_packet(recv_fd, from, in_packet.data(), size);
+            }
+            close(send_fd);
+            close(recv_fd);
+        }});
+        // a batch of 32 packets per iteration
+        benchmarks.push_back({"socket/batch32/" + std::to_string(size), 32L * size,
+                [size](long iterations) {
+            struct sockaddr_in send_addr, recv_addr;
+            int send_fd = loopback_socket(send_addr);
+            int recv_fd = loopback_socket(recv_addr);
+            Transport transport(send_fd);
+            PacketBatch out(32, size), in(32, size);
+            std::vector<char> packet(size, 0);
+            for (long i = 0; i != iterations; ++i) {
+                while (!out.full()) {
+                    out.push(recv_addr, packet.data(), size);
+                }
+                out.send(transport);
+                for (int received = 0; received < 32;) {
+                    int n = in.recv(recv_fd, 0);
+                    if (n < 0) {
+                        break;
+                    }
+                    received += n;
+                }
+            }
+            close(send_fd);
+            close(recv_fd);
+        }});
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// forward error correction
+
+static void add_fec(std::vector<Benchmark>& benchmarks) {
+    const int segment = 8960;
+    // one multiply-add of a segment, per kernel the CPU has (the kernel is switched for the
+    // run only)
+    for (const char* kernel : {"avx2", "ssse3", "scalar"}) {
+        std::string previous = gf_kernel();
+        if (!gf_use_kernel(kernel)) {
+            continue;
+        }
+        gf_use_kernel(previous);
+        benchmarks.push_back({std::string("fec/mul_add/") + kernel, segment, 
+                [kernel, segment](long iterations) {
+            std::string previous = gf_kernel();
+            gf_use_kernel(kernel);
+            std::vector<char> src(segment, 'x'), dst(segment);
+            for (long i = 0; i != iterations; ++i) {
+                gf_mul_add((uint8_t) (i % 254 + 2), src.data(), dst.data(), segment);
+                keep(dst.data());
+            }
+            gf_use_kernel(previous);
+        }});
+    }
+    // parity of a block of 16 data packets, per data packet
+    for (int m : {1, 2, 4}) {
+        benchmarks.push_back({"fec/encode/16+" + std::to_string(m), segment, 
+                [m, segment](long iterations) {
+            std::vector<char> payload(segment, 'x');
+            FecEncoder encoder(segment);
+            for (long i = 0; i != iterations; ++i) {
+                if (i % 16 == 0) {
+                    encoder.start(16, m, segment);
+                }
+                encoder.add(payload.data(), segment);
+                keep(encoder.parity(0));
+            }
+        }});
+    }
+    // a block of 16 with m packets lost, per block
+    for (int m : {1, 2, 4}) {
+        benchmarks.push_back({"fec/decode/16-" + std::to_string(m), 16L * segment, 
+                [m, segment](long iterations) {
+            std::vector<std::vector<char>> payloads(16, std::vector<char>(segment));
+            std::mt19937 random(1);
+            FecEncoder encoder(segment);
+            encoder.start(16, m, segment);
+            for (std::vector<char>& payload : payloads) {
+                for (char& c : payload) {
+                    c = (char) random();
+                }
+                encoder.add(payload.data(), segment);
+            }
+            const char* data[16];
+            for (int i = 0; i != 16; ++i) {
+                data[i] = i < m ? NULL : payloads[i].data();
+            }
+            uint8_t index[FEC_MAX_PARITY];
+            const char* parity[FEC_MAX_PARITY];
+            std::vector<char> rebuilt((size_t) m * segment);
+            char* recovered[FEC_MAX_PARITY];
+            for (int j = 0; j != m; ++j) {
+                index[j] = j;
+                parity[j] = encoder.parity(j);
+                recovered[j] = rebuilt.data() + (size_t) j * segment;
+            }
+            for (long i = 0; i != iterations; ++i) {
+                fec_decode(16, segment, data, m, index, parity, recovered);
+                keep(rebuilt.data());
+            }
+            if (memcmp(rebuilt.data(), payloads[0].data(), segment) != 0) {
+                fprintf(stderr, "fec/decode: wrong data\n");
+                exit(EXIT_FAILURE);
+            }
+        }});
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// checksums
+
+static void add_checksum(std::vector<Benchmark>& benchmarks) {
+    // CRC32C of a payload, per kernel the CPU has (the kernel is switched for the run only)
+    for (const char* kernel : {"vpclmul", "pclmul", "sse42", "scalar"}) {
+        std::string previous = crc32c_kernel();
+        if (!crc32c_use_kernel(kernel)) {
+            continue;
+        }
+        crc32c_use_kernel(previous);
+        for (int size : {1460, 8960}) {
+            benchmarks.push_back({"checksum/crc32c/" + std::string(kernel) + "/" 
+                    + std::to_string(size), size, [kernel, size](long iterations) {
+                std::string previous = crc32c_kernel();
+                crc32c_use_kernel(kernel);
+                std::vector<char> data(size, 'x');
+                uint32_t crc = 0;
+                for (long i = 0; i != iterations; ++i) {
+                    keep(data.data());
+                    crc = crc32c(crc, data.data(), size);
+                }
+                keep(&crc);
+                crc32c_use_kernel(previous);
+            }});
+        }
+    }
+    // what each end adds per data packet: the client seals the packet and extends the digest
+    // with its CRC, the server verifies it
+    for (int segment : {1460, 8960}) {
+        HeaderOptions header_options;
+        header_options.checksum = true;
+        benchmarks.push_back({"checksum/seal/" + std::to_string(segment), segment, 
+                [segment, header_options](long iterations) {
+            std::vector<char> packet(PACKED_HEADER_SIZE + CHECKSUM_OPTION_SIZE + segment, 'x');
+            HeaderView header(packet.data());
+            header.reset(PACKED_VERSION);
+            header.set_options_length(encode_header_options(header_options, header.options()));
+            Crc32cShift shift(segment);
+            uint32_t digest = 0;
+            for (long i = 0; i != iterations; ++i) {
+                header.set_seq_number((uint32_t) i);
+                digest = shift.combine(digest, write_packet_checksum(packet.data(), 
+                            packet.size()));
+            }
+            keep(&digest);
+        }});
+        benchmarks.push_back({"checksum/verify/" + std::to_string(segment), segment, 
+                [segment, header_options](long iterations) {
+            std::vector<char> packet(PACKED_HEADER_SIZE + CHECKSUM_OPTION_SIZE + segment, 'x');
+            HeaderView header(packet.data());
+            header.reset(PACKED_VERSION);
+            header.set_options_length(encode_header_options(header_options, header.options()));
+            write_packet_checksum(packet.data(), packet.size());
+            long ok = 0;
+            for (long i = 0; i != iterations; ++i) {
+                keep(packet.data());
+                ok += packet_checksum_ok(packet.data(), packet.size());
+            }
+            if (ok != iterations) {
+                fprintf(stderr, "checksum/verify: wrong checksum\n");
+                exit(EXIT_FAILURE);
+            }
+        }});
+    }
+}
+
+// ---------------------------------------------------------------------------------------
+// logging
+
+static void add_log(std::vector<Benchmark>& benchmarks) {
+    Header header = {123456789, 987654321, true, false, false, PACKED_VERSION};
+    benchmarks.push_back({"log/format_log_record", 0, [header](long iterations) {
+        char line[128];
+        for (long i = 0; i != iterations; ++i) {
+            LogRecord record = make_log_record(LOG_SEND, header, 35840, 17920, false, i);
+            format_log_record(record, line, sizeof(line));
+            keep(line);
+        }
+    }});
+    // stdout is /dev/null while the benchmarks run
+    benchmarks.push_back({"log/print_log_text", 0, [header](long iterations) {
+        for (long i = 0; i != iterations; ++i) {
+            print_log("SEND", header, 35840, 17920, false);
+        }
+        fflush(stdout);
+    }});
+    // opens the event log, so it must be the last benchmark writing logs
+    benchmarks.push_back({"log/print_log_event_log", 0, [header](long iterations) {
+        static bool opened = false;
+        if (!opened && open_event_log("/dev/null") == -1) {
+            print_sys_error("Cannot open event log");
+            exit(EXIT_FAILURE);
+        }
+        opened = true;
+        for (long i = 0; i != iterations; ++i) {
+            print_log("SEND", header, 35840, 17920, false);
+        }
+    }});
+}
+
+// ---------------------------------------------------------------------------------------
+
+static std::string create_file(size_t size) {
+    char path[] = "/tmp/bench_micro_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == -1) {
+        print_sys_error("Cannot create benchmark file");
+        exit(EXIT_FAILURE);
+    }
+    std::vector<char> chunk(1 << 20);
+    std::mt19937 random(1);
+    for (char& c : chunk) {
+        c = (char) random();
+    }
+    for (size_t written = 0; written < size; written += chunk.size()) {
+        if (write(fd, chunk.data(), chunk.size()) != (ssize_t) chunk.size()) {
+            print_sys_error("Cannot write benchmark file");
+            exit(EXIT_FAILURE);
+        }
+    }
+    close(fd);
+    return path;
+}
+
+int main(int argc, char** argv) {
+    std::string filter;
+    double min_time = 0.2;
+    bool json = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string value;
+        if (parse_option(argv[i], "min-time", value) && std::atoi(value.c_str()) > 0) {
+            // milliseconds
+            min_time = std::atoi(value.c_str()) / 1000.0;
+        }
+        else if (parse_option(argv[i], "json", value) && value.empty()) {
+            json = true;
+        }
+        else if (argv[i][0] != '-') {
+            filter = argv[i];
+        }
+        else {
+            FATAL("unknown option: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    std::string path = create_file(PACKETIZE_FILE_SIZE);
+    std::vector<Benchmark> benchmarks;
+    add_reassembly(benchmarks);
+    add_sack(benchmarks);
+    add_packetize(benchmarks, path);
+    add_header(benchmarks);
+    add_socket(benchmarks);
+    add_fec(benchmarks);
+    add_checksum(benchmarks);
+    add_log(benchmarks);
+
+    // results go to stderr while stdout (print_log) is discarded
+    int out = dup(STDOUT_FILENO);
+    FILE* report = fdopen(out, "w");
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        print_sys_error("Cannot redirect stdout");
+        exit(EXIT_FAILURE);
+    }
+    if (json) {
+        fprintf(report, "[");
+    }
+    else {
+        fprintf(report, "%-44s %14s %12s %14s\n", "Benchmark", "Time (ns)", "Iterations",
+                "Throughput");
+    }
+    bool first = true;
+    for (const Benchmark& benchmark : benchmarks) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        Result result = run_benchmark(benchmark, min_time);
+        if (json) {
+            fprintf(report, "%s\n {\"name\": \"%s\", \"ns_per_iteration\": %.2f, "
+                    "\"iterations\": %ld, \"bytes_per_second\": %.0f}", first ? "" : ",",
+                    result.name.c_str(), result.ns_per_iteration, result.iterations,
+                    result.bytes_per_second);
+        }
+        else {
+            char throughput[32] = "";
+            if (benchmark.bytes > 0) {
+                snprintf(throughput, sizeof(throughput), "%.1f MB/s",
+                        result.bytes_per_second / 1e6);
+            }
+            fprintf(report, "%-44s %14.1f %12ld %14s\n", result.name.c_str(),
+                    result.ns_per_iteration, result.iterations, throughput);
+        }
+        fflush(report);
+        first = false;
+    }
+    if (json) {
+        fprintf(report, "\n]\n");
+    }
+    fclose(report);
+    unlink(path.c_str());
+    return 0;
+}
@@ -0,0 +1,280 @@
+#!/usr/bin/env python3
+# encoding: utf-8
+"""End-to-end benchmark: ./server and ./client over loopback.
+
+Every combination of profile, file size, congestion control and I/O mode is one transfer
+with a fresh server. Impairments come from the in-process emulator (--netem, applied by
+each end to the packets it sends), so no root is needed. Results are written as JSON:
+
+    {"meta": {...}, "results": [{"profile": ..., "size": ..., "goodput_mbps": ..., ...}],
+     "summary": [{"profile": ..., "mode": ..., "goodput_mbps": median, "vs_batch": ...}]}
+
+The summary compares the median goodput of every mode with the first mode given, e.g.
+--modes batch,checksum --repeat 5 gives the throughput cost of checksums.
+
+usage: python3 bench/run_bench.py [--sizes 1K,10M] [--profiles clean,loss] [--cc reno,bbr]
+                                  [--modes batch,gso] [--repeat N] [--out FILE]
+"""
+
+import argparse
+import filecmp
+import json
+import os
+import platform
+import shutil
+import signal
+import socket
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+# sizes of gen_files.sh, including the commented out ones, up to 1 GB
+SIZES = ['11', '128', '256', '513', '1K', '10K', '50K', '100K', '1M', '10M', '100M', '1G']
+
+# netem spec of the server (ACKs) and of the client (data), and the largest size worth
+# running under the profile
+PROFILES = {
+    'clean': ('', '', '1G'),
+    'loss': ('loss=1%', 'loss=1%', '100M'),
+    'burst': ('', 'gemodel=1%:25%', '100M'),
+    'wan': ('delay=10ms,jitter=1ms', 'delay=10ms,jitter=1ms,loss=0.5%', '100M'),
+    'bw': ('delay=5ms', 'rate=100mbit,delay=5ms,limit=200', '100M'),
+}
+
+# options of the server and of the client
+MODES = {
+    'batch': ([], []),
+    'nobatch': (['--batch=1'], ['--batch=1']),
+    'gso': (['--gro'], ['--gso']),
+    'fec': ([], ['--fec']),
+    'checksum': ([], ['--checksum']),
+}
+
+UNITS = {'K': 1 << 10, 'M': 1 << 20, 'G': 1 << 30}
+
+
+def parse_size(size):
+    if size[-1] in UNITS:
+        return int(size[:-1]) * UNITS[size[-1]]
+    return int(size)
+
+
+def free_port():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(('127.0.0.1', 0))
+    port = sock.getsockname()[1]
+    sock.close()
+    return port
+
+
+def make_file(directory, size):
+    path = os.path.join(directory, 'test_%s.data' % size)
+    if not os.path.exists(path):
+        remaining = parse_size(size)
+        with open(path, 'wb') as wf:
+            while remaining > 0:
+                chunk = min(remaining, 1 << 24)
+                wf.write(os.urandom(chunk))
+                remaining -= chunk
+    return path
+
+
+def wait_rusage(process):
+    """Wait for the process, returns its exit status and resource usage."""
+    _, status, usage = os.wait4(process.pid, 0)
+    process.returncode = os.waitstatus_to_exitcode(status)
+    return process.returncode, usage
+
+
+def peak_rss_kb(pid):
+    """VmHWM of a running process; ru_maxrss of a child also counts the memory of this
+    interpreter, which it had before exec."""
+    try:
+        with open('/proc/%d/status' % pid) as rf:
+            for line in rf:
+                if line.startswith('VmHWM:'):
+                    return int(line.split()[1])
+    except OSError:
+        pass
+    return None
+
+
+def cpu_seconds(usage):
+    return usage.ru_utime + usage.ru_stime
+
+
+def run_one(args, data_dir, profile, size, cc, mode):
+    server_netem, client_netem, _ = PROFILES[profile]
+    server_opts, client_opts = MODES[mode]
+    data = make_file(data_dir, size)
+    work = tempfile.mkdtemp(prefix='run_', dir=data_dir)
+    port = free_port()
+    server_cmd = [os.path.join(args.bin, 'server'), str(port)] + server_opts
+    if server_netem:
+        server_cmd.append('--netem=%s,seed=%d' % (server_netem, args.seed))
+    stats_path = os.path.join(work, 'stats.json')
+    client_cmd = [os.path.join(args.bin, 'client'), '127.0.0.1', str(port), data,
+                  '--cc=' + cc, '--stats=' + stats_path] + client_opts
+    if client_netem:
+        client_cmd.append('--netem=%s,seed=%d' % (client_netem, args.seed))
+
+    devnull = subprocess.DEVNULL
+    server = subprocess.Popen(server_cmd, cwd=work, stdout=devnull, stderr=devnull)
+    time.sleep(0.2)
+    start = time.monotonic()
+    client = subprocess.Popen(client_cmd, cwd=work, stdout=devnull, stderr=devnull)
+    try:
+        # the client gives up by itself after its own timeouts
+        client_status, client_usage = wait_rusage(client)
+    finally:
+        wall = time.monotonic() - start
+        server_rss = peak_rss_kb(server.pid)
+        server.send_signal(signal.SIGTERM)
+        _, server_usage = wait_rusage(server)
+
+    result = {
+        'profile': profile,
+        'size': size,
+        'bytes': parse_size(size),
+        'cc': cc,
+        'mode': mode,
+        'ok': False,
+        'wall_s': round(wall, 4),
+        'client_cpu_s': round(cpu_seconds(client_usage), 4),
+        'server_cpu_s': round(cpu_seconds(server_usage), 4),
+        'server_peak_rss_kb': server_rss,
+    }
+    output = os.path.join(work, '1.file')
+    if client_status == 0 and os.path.exists(stats_path):
+        with open(stats_path) as rf:
+            stats = json.load(rf)
+        result['ok'] = os.path.exists(output) and filecmp.cmp(data, output, shallow=False)
+        # completion is everything but the final wait of the client for lost FIN-ACKs
+        completion_us = stats['handshake_us'] + stats['transfer_us'] + stats['close_us']
+        transfer_s = max(stats['transfer_us'], 1) / 1e6
+        packets = max(stats['data_packets'], 1)
+        result.update({
+            'client_peak_rss_kb': stats['peak_rss_kb'],
+            'segment': stats['segment'],
+            'completion_s': round(completion_us / 1e6, 6),
+            'transfer_s': round(transfer_s, 6),
+            'goodput_mbps': round(stats['bytes'] * 8 / transfer_s / 1e6, 3),
+            'packets_per_s': round(stats['data_packets'] / transfer_s, 1),
+            'data_packets': stats['data_packets'],
+            'retransmissions': stats['retransmissions'],
+            'retrans_ratio': round(stats['retransmissions'] / packets, 6),
+            'parity_packets': stats['parity_packets'],
+            'recovered': stats['recovered'],
+        })
+    shutil.rmtree(work, ignore_errors=True)
+    return result
+
+
+def summarize(results, modes):
+    """Median goodput of each mode per profile, size and congestion control, and its change
+    against the first mode in percent."""
+    medians = {}
+    for result in results:
+        if result['ok']:
+            key = (result['profile'], result['size'], result['cc'], result['mode'])
+            medians.setdefault(key, []).append(result['goodput_mbps'])
+    summary = []
+    for key in sorted(medians, key=lambda k: (k[0], parse_size(k[1]), k[2], modes.index(k[3]))):
+        entry = {'profile': key[0], 'size': key[1], 'cc': key[2], 'mode': key[3],
+                 'runs': len(medians[key]),
+                 'goodput_mbps': round(statistics.median(medians[key]), 3)}
+        base = key[:3] + (modes[0],)
+        if key[3] != modes[0] and base in medians:
+            base_goodput = statistics.median(medians[base])
+            entry['vs_' + modes[0]] = round(
+                (entry['goodput_mbps'] - base_goodput) / base_goodput * 100, 2)
+        summary.append(entry)
+    return summary
+
+
+def git_commit(directory):
+    try:
+        return subprocess.check_output(['git', 'rev-parse', '--short', 'HEAD'], cwd=directory,
+                                       stderr=subprocess.DEVNULL).decode().strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def main():
+    root = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    parser = argparse.ArgumentParser(description=__doc__.split('\n')[0])
+    parser.add_argument('--bin', default=root, help='directory of ./server and ./client')
+    parser.add_argument('--sizes', default=','.join(SIZES))
+    parser.add_argument('--profiles', default=','.join(PROFILES))
+    parser.add_argument('--cc', default='reno,cubic,bbr')
+    parser.add_argument('--modes', default='batch')
+    parser.add_argument('--repeat', type=int, default=1)
+    parser.add_argument('--seed', type=int, default=1, help='seed of the emulator')
+    parser.add_argument('--data-dir', default=None, help='test files, a temporary directory '
+                        'by default')
+    parser.add_argument('--out', default='-', help='JSON output file, - for stdout')
+    args = parser.parse_args()
+
+    sizes = args.sizes.split(',')
+    profiles = args.profiles.split(',')
+    modes = args.modes.split(',')
+    for name, table in (('profile', PROFILES), ('mode', MODES)):
+        for key in (profiles if name == 'profile' else modes):
+            if key not in table:
+                parser.error('unknown %s: %s' % (name, key))
+
+    data_dir = args.data_dir or tempfile.mkdtemp(prefix='tcp_bench_')
+    os.makedirs(data_dir, exist_ok=True)
+    results = []
+    try:
+        for profile in profiles:
+            limit = parse_size(PROFILES[profile][2])
+            for size in sizes:
+                if parse_size(size) > limit:
+                    continue
+                for cc in args.cc.split(','):
+                    # modes take turns, so that drift of the host hits all of them alike
+                    for _ in range(args.repeat):
+                        for mode in modes:
+                            result = run_one(args, data_dir, profile, size, cc, mode)
+                            results.append(result)
+                            sys.stderr.write('%-6s %5s %-5s %-7s %s %s\n' % (
+                                profile, size, cc, mode, 'ok ' if result['ok'] else 'BAD',
+                                '%.1f Mbit/s' % result['goodput_mbps']
+                                if 'goodput_mbps' in result else ''))
+    finally:
+        if args.data_dir is None:
+            shutil.rmtree(data_dir, ignore_errors=True)
+
+    report = {
+        'meta': {
+            'commit': git_commit(root),
+            'host': platform.node(),
+            'kernel': platform.release(),
+            'cpus': os.cpu_count(),
+            'time': time.strftime('%Y-%m-%dT%H:%M:%S%z'),
+            'seed': args.seed,
+        },
+        'results': results,
+        'summary': summarize(results, modes),
+    }
+    for entry in report['summary']:
+        change = entry.get('vs_' + modes[0])
+        sys.stderr.write('%-6s %5s %-5s %-10s median %.1f Mbit/s over %d%s\n' % (
+            entry['profile'], entry['size'], entry['cc'], entry['mode'],
+            entry['goodput_mbps'], entry['runs'],
+            ', %+.2f%% vs %s' % (change, modes[0]) if change is not None else ''))
+    text = json.dumps(report, indent=2) + '\n'
+    if args.out == '-':
+        sys.stdout.write(text)
+    else:
+        with open(args.out, 'w') as wf:
+            wf.write(text)
+    # a failed transfer fails the target
+    return 0 if all(result['ok'] for result in results) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
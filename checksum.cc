@@ -0,0 +1,345 @@
+#include "checksum.h"
+#include "packet.h"
+// C headers
+#include <cstring>
+// C++ headers
+#include <vector>
+// the x86-64 kernels are compiled for SSE4.2, PCLMULQDQ and VPCLMULQDQ and picked at run time
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define CRC_X86_KERNELS
+#endif
+
+// Castagnoli polynomial, bit-reversed
+static const uint32_t CRC32C_POLY = 0x82f63b78;
+
+// slicing-by-8: table[k][b] is the CRC of byte b followed by k zero bytes
+struct CrcTables {
+    uint32_t table[8][256];
+
+    CrcTables();
+};
+
+CrcTables::CrcTables() {
+    for (int b = 0; b != 256; ++b) {
+        uint32_t crc = b;
+        for (int bit = 0; bit != 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+        }
+        table[0][b] = crc;
+    }
+    for (int k = 1; k != 8; ++k) {
+        for (int b = 0; b != 256; ++b) {
+            uint32_t crc = table[k - 1][b];
+            table[k][b] = (crc >> 8) ^ table[0][crc & 0xff];
+        }
+    }
+}
+
+static const CrcTables& tables() {
+    static const CrcTables crc_tables;
+    return crc_tables;
+}
+
+// kernels work on the register of the CRC, which crc32c() inverts before and after
+static uint32_t crc_scalar(uint32_t crc, const uint8_t* data, size_t length) {
+    const uint32_t (*table)[256] = tables().table;
+    for (; length >= 8; data += 8, length -= 8) {
+        crc ^= data[0] | data[1] << 8 | data[2] << 16 | (uint32_t) data[3] << 24;
+        crc = table[7][crc & 0xff] ^ table[6][(crc >> 8) & 0xff]
+            ^ table[5][(crc >> 16) & 0xff] ^ table[4][crc >> 24]
+            ^ table[3][data[4]] ^ table[2][data[5]] ^ table[1][data[6]] ^ table[0][data[7]];
+    }
+    for (; length != 0; ++data, --length) {
+        crc = (crc >> 8) ^ table[0][(crc ^ *data) & 0xff];
+    }
+    return crc;
+}
+
+Crc32cShift::Crc32cShift(size_t length) {
+    // the map of each bit of the register, then of each byte of it
+    std::vector<uint8_t> zeros(length);
+    uint32_t bits[32];
+    for (int bit = 0; bit != 32; ++bit) {
+        bits[bit] = crc_scalar((uint32_t) 1 << bit, zeros.data(), length);
+    }
+    for (int i = 0; i != 4; ++i) {
+        for (int b = 0; b != 256; ++b) {
+            uint32_t crc = 0;
+            for (int bit = 0; bit != 8; ++bit) {
+                if (b >> bit & 1) {
+                    crc ^= bits[8 * i + bit];
+                }
+            }
+            table[i][b] = crc;
+        }
+    }
+}
+
+#ifdef CRC_X86_KERNELS
+// bytes of each of the three streams of crc_sse42()
+static const size_t CRC_LANE = 256;
+
+// The CRC32 instruction takes 3 cycles and starts one per cycle, so three independent streams
+// over consecutive lanes keep it busy; their CRCs are then combined with a table lookup.
+__attribute__((target("sse4.2")))
+static uint32_t crc_sse42(uint32_t crc, const uint8_t* data, size_t length) {
+    static const Crc32cShift lane_shift(CRC_LANE);
+    for (; length >= 3 * CRC_LANE; data += 3 * CRC_LANE, length -= 3 * CRC_LANE) {
+        uint64_t crc0 = crc;
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        for (size_t i = 0; i != CRC_LANE; i += 8) {
+            uint64_t word0, word1, word2;
+            memcpy(&word0, data + i, 8);
+            memcpy(&word1, data + CRC_LANE + i, 8);
+            memcpy(&word2, data + 2 * CRC_LANE + i, 8);
+            crc0 = _mm_crc32_u64(crc0, word0);
+            crc1 = _mm_crc32_u64(crc1, word1);
+            crc2 = _mm_crc32_u64(crc2, word2);
+        }
+        crc = lane_shift.combine(lane_shift.combine(crc0, crc1), crc2);
+    }
+    uint64_t crc64 = crc;
+    for (; length >= 8; data += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, data, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = crc64;
+    for (; length != 0; ++data, --length) {
+        crc = _mm_crc32_u8(crc, *data);
+    }
+    return crc;
+}
+
+// PCLMULQDQ operand of x^n mod P: bit-reversed, with x^m at bit 63 - m
+static uint64_t fold_constant(unsigned n) {
+    uint32_t crc = 1;
+    for (unsigned i = 0; i != n; ++i) {
+        // the polynomial in normal bit order, 0x1edc6f41
+        crc = crc & 0x80000000 ? crc << 1 ^ 0x1edc6f41 : crc << 1;
+    }
+    uint64_t constant = 0;
+    for (int m = 0; m != 32; ++m) {
+        constant |= (uint64_t) (crc >> m & 1) << (63 - m);
+    }
+    return constant;
+}
+
+// Folding moves 16 bytes of data `bits` further while keeping the CRC: the block is replaced 
+// by its low and high halves multiplied by x^(bits + 64) and x^bits mod P, both carry-less 
+// products of 64 x 32 bits, and added to the data there. Each pair is [low, high], twice for 
+// both lanes of a 256-bit register.
+struct FoldConstants {
+    uint64_t fold_128[2];  // onto the next 16 bytes
+    uint64_t fold_256[4];  // 32 bytes further
+    uint64_t fold_512[2];  // 64 bytes further, the stride of crc_pclmul()
+    uint64_t fold_1024[4]; // 128 bytes further, the stride of crc_vpclmul()
+
+    FoldConstants();
+};
+
+FoldConstants::FoldConstants() {
+    // the product of reversed operands is one bit short of the block, hence bits - 1
+    for (int lane = 0; lane != 2; ++lane) {
+        fold_256[2 * lane] = fold_constant(256 + 63);
+        fold_256[2 * lane + 1] = fold_constant(256 - 1);
+        fold_1024[2 * lane] = fold_constant(1024 + 63);
+        fold_1024[2 * lane + 1] = fold_constant(1024 - 1);
+    }
+    fold_128[0] = fold_constant(128 + 63);
+    fold_128[1] = fold_constant(128 - 1);
+    fold_512[0] = fold_constant(512 + 63);
+    fold_512[1] = fold_constant(512 - 1);
+}
+
+static const FoldConstants& fold_constants() {
+    static const FoldConstants constants;
+    return constants;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static inline __m128i fold_16(__m128i block, __m128i constants, __m128i next) {
+    return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(block, constants, 0x00), 
+                _mm_clmulepi64_si128(block, constants, 0x11)), next);
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static inline __m128i load_16(const void* data) {
+    return _mm_loadu_si128((const __m128i*) data);
+}
+
+// CRC of the 16 bytes of a folded block followed by data: the rest is folded 16 bytes at a 
+// time and the last block reduced by the CRC32 instruction
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc_folded(__m128i block, const uint8_t* data, size_t length) {
+    __m128i fold_128 = load_16(fold_constants().fold_128);
+    for (; length >= 16; data += 16, length -= 16) {
+        block = fold_16(block, fold_128, load_16(data));
+    }
+    uint64_t crc = _mm_crc32_u64(0, _mm_cvtsi128_si64(block));
+    crc = _mm_crc32_u64(crc, _mm_extract_epi64(block, 1));
+    return crc_sse42(crc, data, length);
+}
+
+// four independent blocks cover the latency of PCLMULQDQ, 64 bytes per round
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t crc_pclmul(uint32_t crc, const uint8_t* data, size_t length) {
+    if (length < 64) {
+        return crc_sse42(crc, data, length);
+    }
+    // the register of the CRC adds to the first bytes
+    __m128i block0 = _mm_xor_si128(load_16(data), _mm_cvtsi32_si128(crc));
+    __m128i block1 = load_16(data + 16);
+    __m128i block2 = load_16(data + 32);
+    __m128i block3 = load_16(data + 48);
+    __m128i fold_512 = load_16(fold_constants().fold_512);
+    for (data += 64, length -= 64; length >= 64; data += 64, length -= 64) {
+        block0 = fold_16(block0, fold_512, load_16(data));
+        block1 = fold_16(block1, fold_512, load_16(data + 16));
+        block2 = fold_16(block2, fold_512, load_16(data + 32));
+        block3 = fold_16(block3, fold_512, load_16(data + 48));
+    }
+    __m128i fold_128 = load_16(fold_constants().fold_128);
+    block0 = fold_16(fold_16(fold_16(block0, fold_128, block1), fold_128, block2), fold_128, 
+            block3);
+    return crc_folded(block0, data, length);
+}
+
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static inline __m256i fold_32(__m256i block, __m256i constants, __m256i next) {
+    return _mm256_xor_si256(_mm256_xor_si256(_mm256_clmulepi64_epi128(block, constants, 0x00), 
+                _mm256_clmulepi64_epi128(block, constants, 0x11)), next);
+}
+
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static inline __m256i load_32(const void* data) {
+    return _mm256_loadu_si256((const __m256i*) data);
+}
+
+// crc_pclmul() on both lanes of 256-bit registers, 128 bytes per round
+__attribute__((target("avx2,pclmul,vpclmulqdq")))
+static uint32_t crc_vpclmul(uint32_t crc, const uint8_t* data, size_t length) {
+    if (length < 128) {
+        return crc_pclmul(crc, data, length);
+    }
+    __m256i block0 = _mm256_xor_si256(load_32(data), 
+            _mm256_zextsi128_si256(_mm_cvtsi32_si128(crc)));
+    __m256i block1 = load_32(data + 32);
+    __m256i block2 = load_32(data + 64);
+    __m256i block3 = load_32(data + 96);
+    __m256i fold_1024 = load_32(fold_constants().fold_1024);
+    for (data += 128, length -= 128; length >= 128; data += 128, length -= 128) {
+        block0 = fold_32(block0, fold_1024, load_32(data));
+        block1 = fold_32(block1, fold_1024, load_32(data + 32));
+        block2 = fold_32(block2, fold_1024, load_32(data + 64));
+        block3 = fold_32(block3, fold_1024, load_32(data + 96));
+    }
+    __m256i fold_256 = load_32(fold_constants().fold_256);
+    block0 = fold_32(fold_32(fold_32(block0, fold_256, block1), fold_256, block2), fold_256, 
+            block3);
+    __m128i block = fold_16(_mm256_castsi256_si128(block0), load_16(fold_constants().fold_128), 
+            _mm256_extracti128_si256(block0, 1));
+    return crc_folded(block, data, length);
+}
+
+static bool has_sse42() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+static bool has_pclmul() {
+    return __builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul");
+}
+
+static bool has_vpclmul() {
+    return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("pclmul") 
+        && __builtin_cpu_supports("vpclmulqdq");
+}
+#endif
+
+static bool has_scalar() {
+    return true;
+}
+
+struct CrcKernel {
+    const char* name;
+    uint32_t (*crc)(uint32_t crc, const uint8_t* data, size_t length);
+    bool (*supported)();
+};
+
+// fastest first
+static const CrcKernel KERNELS[] = {
+#ifdef CRC_X86_KERNELS
+    {"vpclmul", crc_vpclmul, has_vpclmul},
+    {"pclmul", crc_pclmul, has_pclmul},
+    {"sse42", crc_sse42, has_sse42},
+#endif
+    {"scalar", crc_scalar, has_scalar}
+};
+
+static const CrcKernel* best_kernel() {
+    for (const CrcKernel& kernel : KERNELS) {
+        if (kernel.supported()) {
+            return &kernel;
+        }
+    }
+    return NULL;
+}
+
+// picked once, on first use
+static const CrcKernel*& active_kernel() {
+    static const CrcKernel* kernel = best_kernel();
+    return kernel;
+}
+
+uint32_t crc32c(uint32_t crc, const char* data, size_t length) {
+    return ~active_kernel()->crc(~crc, (const uint8_t*) data, length);
+}
+
+const char* crc32c_kernel() {
+    return active_kernel()->name;
+}
+
+bool crc32c_use_kernel(const std::string& name) {
+    for (const CrcKernel& kernel : KERNELS) {
+        if (name == kernel.name && kernel.supported()) {
+            active_kernel() = &kernel;
+            return true;
+        }
+    }
+    return false;
+}
+
+// the value of the checksum option is the last 4 bytes of the header, in network order
+uint32_t write_packet_checksum(char* packet, int length) {
+    int size = ConstHeaderView(packet).size();
+    uint32_t payload_crc = crc32c(0, packet + size, length - size);
+    uint32_t crc = crc32c(payload_crc, packet, size - 4);
+    char* value = packet + size - 4;
+    value[0] = crc >> 24;
+    value[1] = crc >> 16;
+    value[2] = crc >> 8;
+    value[3] = crc;
+    return payload_crc;
+}
+
+bool packet_checksum_ok(const char* packet, int length, uint32_t* payload_crc) {
+    ConstHeaderView header(packet);
+    int size = header.size();
+    if (header.options_length() < CHECKSUM_OPTION_SIZE
+            || packet[size - CHECKSUM_OPTION_SIZE] != HEADER_OPTION_CHECKSUM
+            || packet[size - CHECKSUM_OPTION_SIZE + 1] != 4) {
+        return false;
+    }
+    uint32_t payload = crc32c(0, packet + size, length - size);
+    uint32_t crc = crc32c(payload, packet, size - 4);
+    const uint8_t* value = (const uint8_t*) packet + size - 4;
+    if (crc != ((uint32_t) value[0] << 24 | value[1] << 16 | value[2] << 8 | value[3])) {
+        return false;
+    }
+    if (payload_crc != NULL) {
+        *payload_crc = payload;
+    }
+    return true;
+}
@@ -0,0 +1,46 @@
+#ifndef _CHECKSUM_H_
+#define _CHECKSUM_H_
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// CRC32C (Castagnoli polynomial, as in iSCSI and ext4) of `length` bytes following data
+// whose CRC is `crc` (0 for none): crc32c(crc32c(0, a), b) is the CRC of a then b, and
+// crc32c(0, "123456789") is 0xe3069283. Computed with the fastest kernel of the CPU.
+uint32_t crc32c(uint32_t crc, const char* data, size_t length);
+
+// name of the kernel of crc32c(): "vpclmul" or "pclmul" (carry-less multiplication on 256 or
+// 128-bit registers), "sse42" (the CRC32 instruction) or "scalar" (tables)
+const char* crc32c_kernel();
+
+// use a given kernel, false if the CPU lacks it; not thread safe, for benchmarks
+bool crc32c_use_kernel(const std::string& name);
+
+// The CRC of a then b from the CRCs of a and of b, for b of a given length, without reading
+// the data again: appending `length` bytes changes the CRC of a by a linear map, kept as
+// tables of 4 x 256 entries.
+class Crc32cShift {
+public:
+    explicit Crc32cShift(size_t length);
+
+    // crc_a of any data, crc_b of `length` bytes
+    uint32_t combine(uint32_t crc_a, uint32_t crc_b) const {
+        return table[0][crc_a & 0xff] ^ table[1][(crc_a >> 8) & 0xff]
+            ^ table[2][(crc_a >> 16) & 0xff] ^ table[3][crc_a >> 24] ^ crc_b;
+    }
+
+private:
+    uint32_t table[4][256];
+};
+
+// Checksum of the packets of connections which negotiated OPTION_CHECKSUM: the CRC32C of the
+// payload followed by the header up to the value of HEADER_OPTION_CHECKSUM, the last option.
+// Writes the value into a packet built in full, returns the CRC32C of the payload alone.
+uint32_t write_packet_checksum(char* packet, int length);
+
+// false if the packet has no checksum or a wrong one, otherwise the CRC32C of the payload is 
+// written to payload_crc if given
+bool packet_checksum_ok(const char* packet, int length, uint32_t* payload_crc = NULL);
+
+#endif
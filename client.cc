@@ -1,8 +1,8 @@
 
 #include "client.h"
 #include "utils.h"
+#include "batch_io.h"
 // C++ headers
-#include <deque>
 #include <vector>
 #include <algorithm>
 // C headers
@@ -10,23 +10,42 @@
 #include <cstdlib> 
 #include <cstring> 
 #include <ctime>
-#include <cassert>
+#include <climits>
+#include <cerrno>
 // LINUX headers
 #include <unistd.h> 
 #include <sys/types.h> 
 #include <sys/socket.h> 
-#include <sys/timerfd.h>
 #include <sys/signalfd.h>
 #include <signal.h>
 #include <arpa/inet.h> 
 #include <netinet/in.h> 
 #include <fcntl.h>
 
+// entry of segment_packets for timers which are not retransmission timers of a packet
+static const size_t NO_PACKET = (size_t) -1;
+
+
+ClientOptions::ClientOptions() : read_mode(READ_MMAP), read_chunk_size(1 << 20), batch_size(32), 
+    gso(false), min_rto_us(10000), max_rto_us(60000000), congestion_control("reno"), sack(true), 
+    pacing("timer"), pmtud(true), fec_block(0), fec_parity(-1), checksum(false) {
+}
+
+TransferStats::TransferStats() : bytes(0), segment(0), data_packets(0), retransmissions(0), 
+    parity_packets(0), recovered(0), handshake_us(0), transfer_us(0), close_us(0) {
+}
 
 Client::Client(const std::string& server_ip, int server_port, int max_seq_number, 
-        int max_packet_size, int cwnd, int max_cwnd, int ssthresh, int MSS) 
-    : cwnd(cwnd), max_cwnd(max_cwnd), ssthresh(ssthresh), MSS(MSS), max_seq_number(max_seq_number), 
-    max_packet_size(max_packet_size) {
+        int max_packet_size, int cwnd, int max_cwnd, int ssthresh, int MSS, 
+        const ClientOptions& options) 
+    : max_cwnd(max_cwnd), MSS(MSS), max_seq_number(max_seq_number), 
+    max_packet_size(max_packet_size), version(LEGACY_VERSION), seq_space(max_seq_number), sack(false), 
+    rtt(500000, options.min_rto_us, options.max_rto_us), // 0.5 sec until the first RTT sample
+    options(options), 
+    max_payload_size(BASE_SEGMENT_SIZE), window_packets(1), first_data_seq(0), data_ack_number(0), 
+    next_new_packet(0), fec(false), fec_encoder(max_packet_size), fec_loss_rate(0), fec_losses(0), 
+    fec_acked_block(0), fec_bytes_inflight(0), checksum(false), file_digest(0),
+    out_batch(options.batch_size, max_packet_size), in_batch(options.batch_size, max_packet_size), pool(max_packet_size, 4) {
 
     // initialize UDP socket, support timeout
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
@@ -34,26 +53,42 @@ Client::Client(const std::string& server_ip, int server_port, int max_seq_number
         exit(EXIT_FAILURE); 
     }
     
+    // packets go through the network emulator if any impairment is set
+    if (options.netem.enabled()) {
+        transport.reset(new NetEmulator(sockfd, options.netem, max_packet_size));
+    }
+    else {
+        transport.reset(new Transport(sockfd));
+    }
+
+    // Reno keeps its original cap, the others are only limited by the receive window of the 
+    // server, known after hand-shaking
+    int window_limit = options.congestion_control == "reno" ? max_cwnd : INT_MAX;
+    cc.reset(create_congestion_control(options.congestion_control, cwnd, ssthresh, MSS, 
+            window_limit));
+    if (!cc) {
+        FATAL("unknown congestion control: %s\n", options.congestion_control.c_str());
+        exit(EXIT_FAILURE);
+    }
+
     // address
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_port = htons(server_port);
     server_addr.sin_addr.s_addr = inet_addr(server_ip.c_str());
     
-    // create timer file descriptor, nonblock
-    retrans_timerfd = timerfd_create(CLOCK_MONOTONIC, O_NONBLOCK);
-    timeout_timerfd = timerfd_create(CLOCK_MONOTONIC, O_NONBLOCK);
-    struct timespec TTL, TO, zero;
-    TTL.tv_sec = 0;
-    TTL.tv_nsec = 500000000; // 0.5 sec = 500 ms = 500000 us = 500000000 
-    TO.tv_sec = 100;
-    TO.tv_nsec = 0;
-    zero.tv_sec = 0;
-    zero.tv_nsec = 0;
-    RTO.it_value = TTL;
-    RTO.it_interval = zero;
-    time_out.it_value = TO;
-    time_out.it_interval = zero;
+    // fall back to one datagram per packet if the kernel can't segment
+    if (options.gso && !out_batch.enable_gso(sockfd)) {
+        print_sys_error("UDP GSO unavailable, sending without segmentation");
+    }
+
+    // create timers, both share the kernel timer of the event loop
+    retrans_timer = loop.create_timer();
+    timeout_timer = loop.create_timer();
+    pacing_timer = loop.create_timer();
+    next_send_us = 0;
+    fq_rate = 0;
+    time_out_us = 100000000;
 
     // create signal file descriptor
     sigset_t mask;
@@ -68,14 +103,10 @@ Client::Client(const std::string& server_ip, int server_port, int max_seq_number
     sigfd = signalfd(-1, &mask, 0);
     
     // add files to monitor
-    fds[0].fd = sockfd;
-    fds[0].events = POLLIN;
-    fds[1].fd = retrans_timerfd;
-    fds[1].events = POLLIN;
-    fds[2].fd = timeout_timerfd;
-    fds[2].events = POLLIN;
-    fds[3].fd = sigfd;
-    fds[3].events = POLLIN;
+    if (sigfd == -1 || loop.add(sockfd) == -1 || loop.add(sigfd) == -1) {
+        print_sys_error("Unable to watch socket");
+        exit(EXIT_FAILURE);
+    }
 
     // set random seed
     srand(time(0));
@@ -83,159 +114,426 @@ Client::Client(const std::string& server_ip, int server_port, int max_seq_number
 }
 
 void Client::release_resources() {
+    transport.reset();
     close(sockfd);
-    close(retrans_timerfd);
-    close(timeout_timerfd);
     close(sigfd);
 }
 
-// new ACK arrives
-void Client::new_ack_arrives(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS) {
-    // check whether slow start or congestion avoidance
-    if (dup_ack_count >= 3) {
-        // if in fast retransmission mode, when meeting a new ACK, set cwnd = ssthresh
-        cwnd = ssthresh;
+void Client::rearrange_queue(InflightQueue& inflight_packets, int& bytes_inflight, 
+        size_t& idx, int cwnd) {
+    // we need to make sure, after calling this function, sum(bytes_inflight) <= cwnd, and 
+    // idx is set properly
+    
+    // if bytes inflight is already smaller than cwnd, direcly return
+    if (bytes_inflight <= cwnd) return;
+
+    while (bytes_inflight > cwnd) {
+        // pop packets from back of inflight_packets
+        int bytes_of_last_packet = inflight_packets.back().bytes;
+        inflight_packets.pop_back();
+        bytes_inflight -= bytes_of_last_packet;
+        idx -= 1;
     }
-    else if (cwnd >= ssthresh) {
-        // congestion avoidance
-        cwnd += MSS * MSS / cwnd;    
+}
+
+// mark packets covered by SACK blocks, they leave the network like acknowledged ones
+void Client::mark_sacked(InflightQueue& inflight_packets, int& bytes_inflight, 
+        size_t idx, const SackBlock* blocks, int count) {
+    if (inflight_packets.empty()) {
+        return;
     }
-    else {
-        // slow start mode
-        cwnd += MSS;
+    // sequence number of the oldest packet in flight
+    uint32_t base = seq_space.add(first_data_seq, 
+            (uint64_t) (idx - inflight_packets.size()) * max_payload_size);
+    for (int i = 0; i != count; ++i) {
+        if (!seq_space.after(blocks[i].end, base)) {
+            // already acknowledged
+            continue;
+        }
+        uint64_t start = 0;
+        if (seq_space.after(blocks[i].start, base)) {
+            start = seq_space.distance(base, blocks[i].start);
+        }
+        uint64_t end = seq_space.distance(base, blocks[i].end);
+        for (size_t j = start / max_payload_size; j < inflight_packets.size(); ++j) {
+            InflightPacket& packet = inflight_packets[j];
+            uint64_t offset = (uint64_t) j * max_payload_size;
+            if (offset + packet.bytes > end) {
+                break;
+            }
+            if (offset >= start && !packet.sacked) {
+                if (!packet.lost) {
+                    bytes_inflight -= packet.bytes;
+                }
+                packet.sacked = true;
+                packet.lost = false;
+                release_segment_timer(packet);
+            }
+        }
     }
-    dup_ack_count = 0;
-    cwnd = std::min(cwnd, max_cwnd);
 }
 
-// duplicated ACK arrives
-bool Client::dup_ack_arrives(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS) {
-    // duplicated ACK
-    dup_ack_count += 1;
-    bool should_retransmit = false;
-    if (dup_ack_count == 3) {
-        // enter fast recovery mode for the first time
-        ssthresh = std::max(cwnd / 2, 1024);
-        cwnd = ssthresh + 3 * MSS;
-        should_retransmit = true;
+// packets missing below the highest SACKed one (every packet not SACKed after a timeout) are
+// lost unless they were retransmitted during the current recovery episode, they leave the 
+// network until they are retransmitted
+void Client::mark_lost(InflightQueue& inflight_packets, int& bytes_inflight, 
+        bool all) {
+    size_t end = inflight_packets.size();
+    while (!all && end != 0 && !inflight_packets[end - 1].sacked) {
+        --end;
     }
-    else if (dup_ack_count > 3) {
-        // receiving more duplicated acks
-        cwnd += MSS;
+    for (size_t j = 0; j != end; ++j) {
+        InflightPacket& packet = inflight_packets[j];
+        if (!packet.sacked && !packet.lost && !packet.recovered) {
+            packet.lost = true;
+            bytes_inflight -= packet.bytes;
+        }
     }
-    cwnd = std::min(cwnd, max_cwnd);
-    return should_retransmit;
 }
 
-// timeout
-void Client::timeout_arrives(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS) {
-    // timeout
-    ssthresh = std::max(cwnd / 2, 1024);
-    cwnd = MSS;
-    dup_ack_count = 0;
-    // 1. retransmit missing packet immediately
-    // 2. squeeze out packets from queue
+// retransmit lost packets, oldest first, as far as the congestion window allows
+void Client::retransmit_lost(InflightQueue& inflight_packets, int& bytes_inflight, 
+        size_t idx) {
+    size_t first = idx - inflight_packets.size();
+    for (size_t j = 0; j != inflight_packets.size(); ++j) {
+        InflightPacket& packet = inflight_packets[j];
+        if (!packet.lost) {
+            continue;
+        }
+        if (bytes_inflight + packet.bytes > cc->cwnd()) {
+            break;
+        }
+        queue_data_packet(first + j);
+        ++transfer_stats.retransmissions;
+        packet.lost = false;
+        packet.retransmitted = true;
+        packet.recovered = true;
+        bytes_inflight += packet.bytes;
+        start_segment_timer(packet, first + j);
+    }
 }
 
-void Client::rearrange_queue(std::deque<int>& inflight_packet_bytes, int& bytes_inflight, 
-        size_t& idx, int cwnd) {
-    // we need to make sure, after calling this function, sum(bytes_inflight) <= cwnd, and 
-    // idx is set properly
-    
-    // if bytes inflight is already smaller than cwnd, direcly return
-    if (bytes_inflight <= cwnd) return;
+// a retransmission gets its own timer, so a lost retransmission is repaired while partial ACKs
+// keep pushing the retransmission timer of the connection back
+void Client::start_segment_timer(InflightPacket& packet, size_t packet_idx) {
+    if (packet.timer < 0) {
+        packet.timer = loop.create_timer();
+        if ((size_t) packet.timer >= segment_packets.size()) {
+            segment_packets.resize(packet.timer + 1, NO_PACKET);
+        }
+        segment_packets[packet.timer] = packet_idx;
+    }
+    loop.start_timer(packet.timer, rtt.rto_us());
+}
 
-    while (bytes_inflight > cwnd) {
-        // pop packets from back of inflight_packet_bytes
-        int bytes_of_last_packet = inflight_packet_bytes.back();
-        inflight_packet_bytes.pop_back();
-        bytes_inflight -= bytes_of_last_packet;
-        idx -= 1;
+void Client::release_segment_timer(InflightPacket& packet) {
+    if (packet.timer >= 0) {
+        segment_packets[packet.timer] = NO_PACKET;
+        loop.destroy_timer(packet.timer);
+        packet.timer = -1;
+    }
+}
+
+// a retransmitted packet is neither acknowledged nor SACKed within RTO, it is lost again
+void Client::segment_timeout(InflightQueue& inflight_packets, int& bytes_inflight, 
+        size_t idx, int timer) {
+    if ((size_t) timer >= segment_packets.size() || segment_packets[timer] == NO_PACKET) {
+        return;
+    }
+    size_t j = segment_packets[timer] - (idx - inflight_packets.size());
+    InflightPacket& packet = inflight_packets[j];
+    if (!packet.sacked && !packet.lost) {
+        packet.lost = true;
+        bytes_inflight -= packet.bytes;
+    }
+}
+
+// timer pacing: a packet may leave once the packets before it drained at the pacing rate; up
+// to about 1 ms of credit is kept, so packets still leave in small batches (and GSO runs), 
+// otherwise the pacing timer is started for the next one
+bool Client::pace(int bytes) {
+    long rate = cc->pacing_rate();
+    if (options.pacing != "timer" || rate <= 0) {
+        return true;
+    }
+    long now = now_us();
+    long quantum_us = std::max(1000L, 2000000L * (data_header_size() + max_payload_size) 
+            / rate);
+    next_send_us = std::max(next_send_us, now - quantum_us);
+    if (next_send_us > now) {
+        if (!loop.timer_active(pacing_timer)) {
+            loop.start_timer(pacing_timer, next_send_us - now);
+        }
+        return false;
+    }
+    next_send_us += 1000000L * (bytes + data_header_size()) / rate;
+    return true;
+}
+
+// fq pacing: hand the rate to the qdisc, unless it barely changed
+void Client::update_pacing_rate() {
+    long rate = cc->pacing_rate();
+    if (options.pacing != "fq" || rate <= 0 || std::labs(rate - fq_rate) * 8 < fq_rate) {
+        return;
+    }
+    fq_rate = rate;
+    unsigned int value = std::min(rate, (long) UINT_MAX);
+    if (setsockopt(sockfd, SOL_SOCKET, SO_MAX_PACING_RATE, &value, sizeof(value)) == -1) {
+        print_sys_error("Unable to set SO_MAX_PACING_RATE, sending without pacing");
+        options.pacing = "none";
     }
 }
 
 void Client::send_file(const std::string& file_path) {
-    // open file (as binary) to read
-    FILE* file = fopen(file_path.c_str(), "rb");
-    if (file == NULL) {
+    // open file (as binary) to read, packets read it on demand
+    if (file.open(file_path, options.read_mode, options.read_chunk_size) == -1) {
         FATAL("file does not exist: %s\n", file_path.c_str());
         exit(EXIT_FAILURE);
     }
-    unsigned long length = 0;
-    fseek(file, 0, SEEK_END);
-    length = ftell(file);
-    fseek(file, 0, SEEK_SET);
-    std::vector<char> message;
-    message.resize(length);
-    fread(message.data(), sizeof(char), length, file);
-    fclose(file);
     // send message
-    send_message(message);
+    send_message();
+    file.close();
 }
 
-// write SYN packet to packet and update seq_number
-void Client::write_syn_packet(std::vector<char>& packet, Header& header, int& seq_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header));
-    header.seq_number = seq_number;
-    header.syn = true;
-    memcpy(packet.data(), &header, sizeof(header));
-    seq_number = (seq_number + 1) % max_seq_number;
+// SYN packet with the options in the payload, padded with zeros up to `length` bytes (path 
+// MTU probes); the version offers 32-bit sequence numbers and the packed header
+int Client::write_syn_packet(char* packet, uint32_t seq_number, const SynOptions& syn_options, 
+        int length) {
+    HeaderView header(packet);
+    header.reset_handshake(PACKED_VERSION);
+    header.set_seq_number(seq_number);
+    header.set_syn(true);
+    int size = HEADER_SIZE + encode_syn_options(syn_options, header.payload());
+    if (length > size) {
+        memset(packet + size, 0, length - size);
+        size = length;
+    }
+    return size;
 }
 
-void Client::write_ack_packet(const char* message, int length, std::vector<char>& packet, Header& header, 
-        int& seq_number, int ack_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header)+length);
-    header.seq_number = seq_number;
-    header.ack_number = ack_number;
-    header.ack = true;
-    memcpy(packet.data(), &header, sizeof(header));
-    memcpy(packet.data()+sizeof(header), message, length * sizeof(char));
-    seq_number = (seq_number + length) % max_seq_number;
+// data packet carrying `length` bytes of the file starting at `offset`
+int Client::write_ack_packet(size_t offset, int length, char* packet, uint32_t& seq_number, 
+        uint32_t ack_number, const HeaderOptions& header_options) {
+    HeaderView header(packet);
+    header.reset(version);
+    header.set_seq_number(seq_number);
+    header.set_ack_number(ack_number);
+    header.set_ack(true);
+    if (header_options.fec || header_options.checksum) {
+        header.set_options_length(encode_header_options(header_options, header.options()));
+    }
+    if (file.read(offset, header.payload(), length) == -1) {
+        print_sys_error("Unable to read file");
+        release_resources();
+        exit(EXIT_FAILURE);
+    }
+    seq_number = seq_space.add(seq_number, length);
+    return header.size() + length;
 }
 
-void Client::write_fin_packet(std::vector<char>& packet, Header& header, int& seq_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header));
-    header.seq_number = seq_number;
-    header.fin = true;
-    memcpy(packet.data(), &header, sizeof(header));
-    seq_number = (seq_number + 1) % max_seq_number;
+// FIN packet, with the digest of the file if the connection has checksums
+int Client::write_fin_packet(char* packet, uint32_t& seq_number) {
+    HeaderView header(packet);
+    header.reset(version);
+    header.set_seq_number(seq_number);
+    header.set_fin(true);
+    if (checksum) {
+        HeaderOptions header_options;
+        header_options.has_digest = true;
+        header_options.digest = file_digest;
+        header_options.checksum = true;
+        header.set_options_length(encode_header_options(header_options, header.options()));
+        write_packet_checksum(packet, header.size());
+    }
+    seq_number = seq_space.add(seq_number, 1);
+    return header.size();
 }
 
 // ACK packet to answer FIN packet, no payload, do not increase seq_number
-void Client::write_fin_ack_packet(std::vector<char>& packet, Header& header, int seq_number, 
-        int ack_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header));
-    header.seq_number = seq_number;
-    header.ack_number = ack_number;
-    header.ack = true;
-    memcpy(packet.data(), &header, sizeof(header));
+int Client::write_fin_ack_packet(char* packet, uint32_t seq_number, uint32_t ack_number) {
+    HeaderView header(packet);
+    header.reset(version);
+    header.set_seq_number(seq_number);
+    header.set_ack_number(ack_number);
+    header.set_ack(true);
+    if (checksum) {
+        HeaderOptions header_options;
+        header_options.checksum = true;
+        header.set_options_length(encode_header_options(header_options, header.options()));
+        write_packet_checksum(packet, header.size());
+    }
     // do not change seq_number
+    return header.size();
+}
+
+size_t Client::count_data_packets() const {
+    return (file.size() + max_payload_size - 1) / max_payload_size;
+}
+
+int Client::data_packet_payload(size_t idx) const {
+    size_t offset = idx * max_payload_size;
+    return std::min(file.size() - offset, (size_t) max_payload_size);
 }
 
-void Client::write_data_packets(const std::vector<char>& message, 
-        std::vector<std::vector<char> >& packets, std::vector<Header>& headers, int& seq_number, 
-        int ack_number) {
-    std::vector<char> packet;
-    Header header;
-    int max_payload_size = max_packet_size - sizeof(Header);
-    // add payloads
-    for (size_t bytes_sent = 0; bytes_sent != message.size();) {
-        int remaining = message.size() - bytes_sent;
-        int payload = 0;
-        if (remaining >= max_payload_size) {
-            payload = max_payload_size;
+// build the idx-th data packet in place and return its size, every packet except the last 
+// one carries a full payload
+int Client::write_data_packet(size_t idx, char* packet) {
+    size_t offset = idx * max_payload_size;
+    uint32_t seq_number = seq_space.add(first_data_seq, offset);
+    HeaderOptions header_options;
+    if (fec) {
+        // blocks start before their first packet is sent
+        size_t block = idx / options.fec_block;
+        header_options.fec = true;
+        if (block < fec_parity.size() && fec_parity[block] != 0) {
+            header_options.fec_block = fec_block_size(idx);
+            header_options.fec_position = idx - block * options.fec_block;
         }
-        else {
-            payload = remaining;
+    }
+    header_options.checksum = checksum;
+    return write_ack_packet(offset, data_packet_payload(idx), packet, seq_number, 
+            data_ack_number, header_options);
+}
+
+// header of the data packets, with the FEC payload id and the checksum if any
+int Client::data_header_size() const {
+    return header_size(version) + (fec ? FEC_OPTION_SIZE : 0) 
+        + (checksum ? CHECKSUM_OPTION_SIZE : 0);
+}
+
+// data packets of the FEC block of the idx-th one, 0 if it is not protected: blocks hold 
+// options.fec_block full packets, the last one may hold less, the last packet of the file is
+// left out unless it is full
+int Client::fec_block_size(size_t idx) const {
+    size_t full_packets = file.size() / max_payload_size;
+    size_t first = idx - idx % options.fec_block;
+    if (idx >= full_packets) {
+        return 0;
+    }
+    return std::min(full_packets - first, (size_t) options.fec_block);
+}
+
+// a block begins with the first transmission of its first packet, it gets enough parity 
+// packets for the losses (retransmitted or rebuilt packets) of the blocks before
+void Client::start_fec_block(size_t idx) {
+    int k = fec_block_size(idx);
+    int m = 0;
+    if (k != 0) {
+        long losses = transfer_stats.retransmissions + transfer_stats.recovered;
+        double sample = std::min(1.0, (double) (losses - fec_losses) / options.fec_block);
+        fec_losses = losses;
+        fec_loss_rate += (sample - fec_loss_rate) / 16;
+        m = options.fec_parity >= 0 ? std::min(options.fec_parity, FEC_MAX_PARITY) 
+            : fec_parity_count(k, fec_loss_rate);
+    }
+    fec_parity.push_back(m);
+    fec_encoder.start(k, m, max_payload_size);
+}
+
+// Parity packets of the block which begins with the first_idx-th data packet, they carry its 
+// sequence number. They take room in the congestion window until the block is acknowledged 
+// and delay the next data packet with timer pacing.
+void Client::queue_parity_packets(size_t first_idx) {
+    uint32_t seq_number = seq_space.add(first_data_seq, (uint64_t) first_idx * max_payload_size);
+    for (int j = 0; j != fec_encoder.parity_packets(); ++j) {
+        char* packet = out_batch.next();
+        HeaderView header(packet);
+        header.reset(version);
+        header.set_seq_number(seq_number);
+        header.set_ack_number(data_ack_number);
+        header.set_ack(true);
+        HeaderOptions header_options;
+        header_options.fec = true;
+        header_options.fec_block = fec_encoder.data_packets();
+        header_options.fec_position = fec_encoder.data_packets() + j;
+        header_options.checksum = checksum;
+        header.set_options_length(encode_header_options(header_options, header.options()));
+        memcpy(header.payload(), fec_encoder.parity(j), max_payload_size);
+        int length = header.size() + max_payload_size;
+        if (checksum) {
+            write_packet_checksum(packet, length);
+        }
+        out_batch.push(server_addr, length);
+        ++transfer_stats.parity_packets;
+        fec_bytes_inflight += max_payload_size;
+        PRINT_LOG_FROM_PACKET("SEND", packet, cc->cwnd(), cc->ssthresh(), false);
+        long rate = cc->pacing_rate();
+        if (options.pacing == "timer" && rate > 0) {
+            next_send_us += 1000000L * length / rate;
+        }
+        if (out_batch.full()) {
+            flush_packets();
         }
-        write_ack_packet(message.data()+bytes_sent, payload, packet, header, seq_number, ack_number);
-        headers.push_back(header);
-        packets.push_back(packet);
-        bytes_sent += payload;
+    }
+}
+
+// Whether the server may still rebuild the idx-th data packet: its block has parity packets 
+// and no packet sent after them is SACKed yet. Duplicated ACKs for such a hole are not 
+// counted, so FEC repairs it instead of a fast retransmission.
+bool Client::fec_may_repair(size_t idx, const SackBlock* blocks, int count) const {
+    if (!fec || count == 0 || idx >= next_new_packet || fec_block_size(idx) == 0 
+            || fec_parity[idx / options.fec_block] == 0) {
+        return false;
+    }
+    size_t end = idx - idx % options.fec_block + fec_block_size(idx);
+    uint32_t end_seq = seq_space.add(first_data_seq, (uint64_t) end * max_payload_size);
+    // the last SACK block is the highest one
+    return !seq_space.after(blocks[count - 1].end, end_seq);
+}
+
+// parity packets of the blocks before the acked-th data packet leave the congestion window
+void Client::release_parity(size_t acked) {
+    for (; fec_acked_block != fec_parity.size(); ++fec_acked_block) {
+        size_t first = fec_acked_block * options.fec_block;
+        size_t end = first + fec_block_size(first);
+        if (end > acked || end > next_new_packet) {
+            break;
+        }
+        fec_bytes_inflight -= fec_parity[fec_acked_block] * max_payload_size;
+    }
+}
+
+// build the idx-th data packet into the outgoing batch, the first transmission of a packet 
+// adds it to the digest of the file and, in a FEC block, to the parity, which follows the 
+// last packet of the block
+void Client::queue_data_packet(size_t idx) {
+    bool first = idx == next_new_packet;
+    if (fec && first && idx % options.fec_block == 0) {
+        start_fec_block(idx);
+    }
+    char* packet = out_batch.next();
+    int length = write_data_packet(idx, packet);
+    uint32_t payload_crc = checksum ? write_packet_checksum(packet, length) : 0;
+    out_batch.push(server_addr, length);
+    ++transfer_stats.data_packets;
+    PRINT_LOG_FROM_PACKET("SEND", packet, cc->cwnd(), cc->ssthresh(), false);
+    bool block_complete = false;
+    if (first) {
+        ++next_new_packet;
+        ConstHeaderView header(packet);
+        int payload = length - header.size();
+        if (checksum) {
+            // the CRC of the packet extends the digest, except for a short last packet
+            file_digest = payload == max_payload_size 
+                ? segment_shift->combine(file_digest, payload_crc) 
+                : crc32c(file_digest, header.payload(), payload);
+        }
+        if (fec && fec_block_size(idx) != 0 && fec_encoder.parity_packets() != 0) {
+            block_complete = fec_encoder.add(header.payload(), payload);
+        }
+    }
+    if (out_batch.full()) {
+        flush_packets();
+    }
+    if (block_complete) {
+        queue_parity_packets(idx + 1 - fec_encoder.data_packets());
+    }
+}
+
+// send all queued packets with one system call
+void Client::flush_packets() {
+    if (!out_batch.empty() && out_batch.send(*transport) < 0) {
+        ERR("ERR: fail to sent packet\n");
     }
 }
 
@@ -262,258 +560,576 @@ void Client::catch_signal() {
 }
 
 // handshaking
-void Client::hand_shaking(const std::vector<char>& packet, std::vector<char>& reply, 
-        Header& header, int expect_ack) {
+void Client::hand_shaking(const char* packet, int length, char* reply, uint32_t syn_seq) {
     bool ok = false;
+    bool retransmitted = false;
+    long sent_us = 0;
     // reset timeout timer
-    reset_timer(timeout_timerfd, time_out);
+    loop.start_timer(timeout_timer, time_out_us);
     for (;!ok;) {
         // send SYN packet
-        int bytes_sent = send_packet(sockfd, server_addr, packet);
+        int bytes_sent = send_packet(*transport, server_addr, packet, length);
         if (bytes_sent < 0) {
             ERR("ERR: fail to sent packet\n");
         }
-        print_log_from_packet("SEND", packet, cwnd, ssthresh, false); 
+        PRINT_LOG_FROM_PACKET("SEND", packet, cc->cwnd(), cc->ssthresh(), false); 
+        retransmitted = sent_us != 0;
+        sent_us = now_us();
         // reset retransmission timer
-        reset_timer(retrans_timerfd, RTO);
+        loop.start_timer(retrans_timer, rtt.rto_us());
         for (;;) {
             // wait for response or timeout or signal
-            int val = poll(fds, 4, -1);
-            if (val < 0) {
+            if (loop.wait() < 0) {
                 // an error occurs
-                print_sys_error("Bad poll calling");
+                print_sys_error("Bad epoll calling");
+                release_resources();
+                exit(EXIT_FAILURE);
+            }
+            // process polling result, a socket and a timer may be ready at the same time
+            if (loop.readable(sigfd)) {
+                // signal captured
+                catch_signal();
+            }
+            if (loop.expired_timer(timeout_timer)) {
+                // close socket and exit with nonzero code
                 release_resources();
                 exit(EXIT_FAILURE);
             }
-            // process polling result
-            if (fds[0].revents != 0) {
+            int reply_length = -1;
+            if (loop.readable(sockfd) 
+                    && (reply_length = recv_packet(sockfd, server_addr, reply, 
+                            max_packet_size)) >= 0) {
                 // socket is readable
-                recv_packet(sockfd, server_addr, reply, header, max_packet_size);
-                print_log("RECV", header, cwnd, ssthresh, false);
-                if (header.ack_number != expect_ack) {
-                    // wrong ack_number
+                ConstHeaderView header(reply);
+                PRINT_LOG_FROM_PACKET("RECV", reply, cc->cwnd(), cc->ssthresh(), false);
+                // servers answer with the highest version they know up to the offered one
+                uint8_t reply_version = std::min(header.version(), (uint8_t) PACKED_VERSION);
+                SeqSpace reply_space(reply_version >= SEQ32_VERSION ? SEQ32_SPACE 
+                        : max_seq_number);
+                if (!header.syn() || header.ack_number() != reply_space.add(syn_seq, 1)) {
+                    // wrong ack_number, will be ignored
                     ERR("ERR: wrong ack_number, will be ignored");
-                    continue; 
                 }
-                // good ack, return
-                ok = true;
-                break;
+                else {
+                    version = reply_version;
+                    seq_space = reply_space;
+                    // the window is limited by the receive buffer of the server, legacy 
+                    // servers buffer half of the sequence space
+                    SynOptions syn_options;
+                    decode_syn_options(header.payload(), reply_length - header.size(), 
+                            syn_options);
+                    if (version == LEGACY_VERSION || syn_options.window == 0) {
+                        syn_options.window = seq_space.half();
+                    }
+                    sack = version >= SEQ32_VERSION && options.sack && syn_options.sack;
+                    cc->use_sack(sack);
+                    fec = version >= PACKED_VERSION && options.fec_block > 0 && syn_options.fec;
+                    checksum = version >= PACKED_VERSION && options.checksum 
+                        && syn_options.checksum;
+                    server_options = syn_options;
+                    // good ack, the first RTT sample unless SYN was sent again
+                    if (!retransmitted) {
+                        long sample = now_us() - sent_us;
+                        rtt.add_sample(sample);
+                        cc->on_rtt_sample(sample, now_us());
+                    }
+                    ok = true;
+                    break;
+                }
             }
-            else if (fds[1].revents != 0) {
+            if (loop.expired_timer(retrans_timer)) {
                 // timeout, resent packet and reset timer
                 ERR("Retransmission timeout!\n");
+                rtt.backoff();
                 break; 
             }
-            else if (fds[2].revents != 0) {
-                // close socket and exit with nonzero code
-                release_resources();
-                exit(EXIT_FAILURE);
-            }
-            else if (fds[3].revents != 0) {
-                // signal captured
-                catch_signal();
-            }
         } // end inner loop
     } // end outer loop
     return;
 }
 
+// wait for the next event of the connection setup, a signal or the timeout timer end the 
+// program
+void Client::wait_handshake_event() {
+    if (loop.wait() < 0) {
+        // an error occurs
+        print_sys_error("Bad epoll calling");
+        release_resources();
+        exit(EXIT_FAILURE);
+    }
+    if (loop.readable(sigfd)) {
+        catch_signal();
+    }
+    if (loop.expired_timer(timeout_timer)) {
+        release_resources();
+        exit(EXIT_FAILURE);
+    }
+}
+
+// Data packets carry the base segment unless the server takes part: then the segment is the
+// largest one both ends accept or, with options.pmtud, the largest one the path carries. The 
+// server confirms a new segment before any data is sent, and the congestion window is 
+// counted in segments of that size.
+void Client::pick_segment_size(char* in_packet, char* out_packet, uint32_t syn_seq) {
+    int limit = std::min((int) server_options.mss, max_packet_size - HEADER_SIZE);
+    // packets are as large as a segment with the 12-byte header (the buffers of both ends) 
+    // with their header options; the server only accepts checksums if they fit with the base
+    // segment, FEC payload ids may not
+    if (fec && limit - (data_header_size() - HEADER_SIZE) < max_payload_size) {
+        DEBUG("segment too small for FEC payload ids, sending without FEC\n");
+        fec = false;
+    }
+    limit -= std::max(data_header_size() - HEADER_SIZE, 0);
+    if (limit > max_payload_size) {
+        int segment = limit;
+        if (options.pmtud) {
+            segment = probe_path_mtu(limit, in_packet, out_packet, syn_seq);
+        }
+        if (segment != max_payload_size) {
+            confirm_segment_size(segment, in_packet, out_packet, syn_seq);
+        }
+    }
+    cc->set_mss(max_payload_size);
+    if (checksum) {
+        segment_shift.reset(new Crc32cShift(max_payload_size));
+    }
+    uint32_t window = std::min(server_options.window, (uint32_t) seq_space.half());
+    cc->limit_window(window);
+    window_packets = std::max(window / max_payload_size, 1U);
+    out_batch.set_segment_size(data_header_size() + max_payload_size);
+}
+
+// Path MTU search in the spirit of DPLPMTUD (RFC 8899): probes are SYN packets padded to the
+// size of a full data packet of a larger segment, sent with the don't-fragment bit, and the
+// server echoes those which arrive. The candidates fill common MTUs up to the limit, they are
+// sent together and each one up to MAX_PROBES times; a probe larger than the MTU of the 
+// interface fails at once. Returns the largest segment which got through.
+int Client::probe_path_mtu(int limit, char* in_packet, char* out_packet, uint32_t syn_seq) {
+    static const int MTUS[] = {1280, 1500, 4352, 9000};
+    static const int MAX_PROBES = 3;
+    std::vector<int> candidates;
+    for (int mtu : MTUS) {
+        int segment = mtu - UDP_IP_OVERHEAD - data_header_size();
+        if (segment > max_payload_size && segment < limit) {
+            candidates.push_back(segment);
+        }
+    }
+    candidates.push_back(limit);
+    // don't fragment, and don't rely on the path MTU of the kernel either
+    int mode = IP_PMTUDISC_PROBE;
+    if (setsockopt(sockfd, IPPROTO_IP, IP_MTU_DISCOVER, &mode, sizeof(mode)) == -1) {
+        print_sys_error("Unable to set IP_MTU_DISCOVER");
+        return max_payload_size;
+    }
+    int best = max_payload_size;
+    size_t fitting = candidates.size(); // candidates before this index may fit the interface
+    loop.start_timer(timeout_timer, time_out_us);
+    for (int round = 0; round != MAX_PROBES && fitting != 0 && best < candidates[fitting - 1]; 
+            ++round) {
+        for (size_t i = 0; i != fitting; ++i) {
+            if (candidates[i] <= best) {
+                continue;
+            }
+            SynOptions probe;
+            probe.probe = candidates[i];
+            int length = write_syn_packet(out_packet, syn_seq, probe, 
+                    data_header_size() + candidates[i]);
+            if (send_packet(*transport, server_addr, out_packet, length) < 0) {
+                if (errno == EMSGSIZE) {
+                    fitting = i;
+                    break;
+                }
+                ERR("ERR: fail to sent packet\n");
+            }
+            PRINT_LOG_FROM_PACKET("SEND", out_packet, cc->cwnd(), cc->ssthresh(), false);
+        }
+        // collect the echoes for one RTO
+        loop.start_timer(retrans_timer, rtt.rto_us());
+        while (fitting != 0 && best < candidates[fitting - 1]) {
+            wait_handshake_event();
+            int reply_length = -1;
+            if (loop.readable(sockfd) 
+                    && (reply_length = recv_packet(sockfd, server_addr, in_packet, 
+                            max_packet_size)) >= 0) {
+                ConstHeaderView reply(in_packet);
+                PRINT_LOG_FROM_PACKET("RECV", in_packet, cc->cwnd(), cc->ssthresh(), false);
+                SynOptions echo;
+                if (reply.syn()) {
+                    decode_syn_options(reply.payload(), reply_length - reply.size(), echo);
+                }
+                if (echo.probe > best && echo.probe <= limit) {
+                    best = echo.probe;
+                }
+            }
+            if (loop.expired_timer(retrans_timer)) {
+                break;
+            }
+        }
+    }
+    DEBUG("path MTU probes picked a segment of %d bytes\n", best);
+    return best;
+}
+
+// ask the server to switch to `segment`, until a SYN-ACK confirms it
+void Client::confirm_segment_size(int segment, char* in_packet, char* out_packet, 
+        uint32_t syn_seq) {
+    SynOptions syn_options;
+    syn_options.segment = segment;
+    int length = write_syn_packet(out_packet, syn_seq, syn_options, 0);
+    loop.start_timer(timeout_timer, time_out_us);
+    for (;;) {
+        if (send_packet(*transport, server_addr, out_packet, length) < 0) {
+            ERR("ERR: fail to sent packet\n");
+        }
+        PRINT_LOG_FROM_PACKET("SEND", out_packet, cc->cwnd(), cc->ssthresh(), false);
+        loop.start_timer(retrans_timer, rtt.rto_us());
+        for (;;) {
+            wait_handshake_event();
+            int reply_length = -1;
+            if (loop.readable(sockfd) 
+                    && (reply_length = recv_packet(sockfd, server_addr, in_packet, 
+                            max_packet_size)) >= 0) {
+                ConstHeaderView reply(in_packet);
+                PRINT_LOG_FROM_PACKET("RECV", in_packet, cc->cwnd(), cc->ssthresh(), false);
+                SynOptions echo;
+                if (reply.syn()) {
+                    decode_syn_options(reply.payload(), reply_length - reply.size(), echo);
+                }
+                if (echo.segment == segment) {
+                    // the receive buffer of the server was rebuilt for the segment
+                    max_payload_size = segment;
+                    if (echo.window != 0) {
+                        server_options.window = echo.window;
+                    }
+                    return;
+                }
+            }
+            if (loop.expired_timer(retrans_timer)) {
+                // timeout, resend SYN
+                rtt.backoff();
+                break;
+            }
+        }
+    }
+}
+
 // send all packets with moving window
-void Client::send_packets_in_window(int last_unacked_seq, 
-        const std::vector<std::vector<char> >& packets, std::vector<char>& in_packet, 
-        Header& in_header) {
+void Client::send_packets_in_window(uint32_t last_unacked_seq, size_t packet_count) {
     int bytes_inflight = 0;
     int bytes_received = 0;
-    std::deque<int> inflight_packet_bytes;
+    InflightQueue inflight_packets;
     // reset timeout timer for the first time
-    reset_timer(timeout_timerfd, time_out);
-    reset_timer(retrans_timerfd, RTO);
+    loop.start_timer(timeout_timer, time_out_us);
+    loop.start_timer(retrans_timer, rtt.rto_us());
     // Goals: 1. after sending packets, maintain bytes_inflight + bytes_received unchanged
-    //        2. sum(inflight_packet_bytes) = bytes_inflight;
+    //        2. sum(inflight_packets.bytes, neither SACKed nor lost) = bytes_inflight;
     //        3. idx is always the index of packet going to be sent
-    assert (sizeof(Header) == 12);
-    int dup_ack_count = 0;
-    for (size_t idx = 0; (idx != packets.size()) || (bytes_inflight != 0) ;) {
+    // packets before this index were sent before (they may be sent again after the queue is 
+    // re-arranged)
+    size_t first_unsent = 0;
+    // with SACK, every hole is retransmitted until the packets sent before the loss (or the
+    // timeout) are acknowledged
+    bool in_recovery = false;
+    size_t recovery_point = 0;
+    SackBlock blocks[MAX_SACK_BLOCKS];
+    for (size_t idx = 0; (idx != packet_count) || !inflight_packets.empty();) {
         int next_packet_size = 0;
-        if (idx != packets.size()) {
-            next_packet_size = packets[idx].size() - sizeof(Header);
+        if (idx != packet_count) {
+            next_packet_size = data_packet_payload(idx);
+        }
+        // lost packets go first
+        if (sack) {
+            retransmit_lost(inflight_packets, bytes_inflight, idx);
         }
         
-        while (next_packet_size != 0 && bytes_inflight + next_packet_size <= cwnd) {
+        update_pacing_rate();
+        // SACKed packets leave the congestion window but not the receive window of the 
+        // server, which starts at the oldest unacknowledged packet
+        while (next_packet_size != 0 && inflight_packets.size() < window_packets 
+                && bytes_inflight + fec_bytes_inflight + next_packet_size <= cc->cwnd() 
+                && pace(next_packet_size)) {
             // good to go
-            const std::vector<char>& packet_to_go = packets[idx];
-            send_packet(sockfd, server_addr, packet_to_go);
-            inflight_packet_bytes.push_back(next_packet_size);
+            queue_data_packet(idx);
+            if (idx < first_unsent) {
+                ++transfer_stats.retransmissions;
+            }
+            InflightPacket inflight = {next_packet_size, now_us(), idx < first_unsent, false, 
+                false, false, -1};
+            inflight_packets.push_back(inflight);
+            first_unsent = std::max(first_unsent, idx + 1);
             bytes_inflight += next_packet_size;
-            print_log_from_packet("SEND", packet_to_go, cwnd, ssthresh, false);
             idx += 1;
-            if (idx == packets.size()) {
+            if (idx == packet_count) {
                 // no more packets to send
                 break;
             }
-            next_packet_size = packets[idx].size() - sizeof(Header);
+            next_packet_size = data_packet_payload(idx);
         }
-        // reset retransmission timer
-        //reset_timer(retrans_timerfd, RTO);
-        int val = poll(fds, 4, -1);
-        if (val < 0) {
+        flush_packets();
+        if (loop.wait() < 0) {
             // an error occurs
-            print_sys_error("Bad poll calling");
+            print_sys_error("Bad epoll calling");
             release_resources();
             exit(EXIT_FAILURE);
         }
-        if (fds[0].revents != 0) {
-            recv_packet(sockfd, server_addr, in_packet, in_header, max_packet_size);
-            print_log("RECV", in_header, cwnd, ssthresh, false);
-            int ack_number = in_header.ack_number;
-            if (ack_number < last_unacked_seq - max_seq_number / 2) {
-                ack_number += max_seq_number;
-            }
-            if (ack_number > last_unacked_seq) {
-                // new ACK arrives, reset retransmission timer
-                reset_timer(retrans_timerfd, RTO);
-                int total_bytes_received = ack_number - last_unacked_seq;
-                bytes_inflight -= std::min(bytes_inflight, total_bytes_received);
-                bytes_received += total_bytes_received;
-                last_unacked_seq = in_header.ack_number;
-                // pop out some inflight packets
-                // TODO check if we need < 0 instead
-                while (total_bytes_received != 0 && !inflight_packet_bytes.empty()) {
-                    DEBUG("Poping out packets\n");
-                    int bytes = inflight_packet_bytes.front();
-                    inflight_packet_bytes.pop_front();
-                    total_bytes_received -= bytes;
+        if (loop.readable(sockfd)) {
+            // handle all ACK packets waiting in the socket
+            int received = in_batch.recv(sockfd, MSG_DONTWAIT);
+            for (int k = 0; k < received; ++k) {
+                if (!header_complete(in_batch.data(k), in_batch.length(k))) {
+                    continue;
                 }
-                // in extreme case (w/ cumulative ACK), the ACK number may be very large 
-                // and exceed the current queue, in this case, move window forward, so that
-                // total_bytes_received == 0
-                while (total_bytes_received != 0) {
-                    DEBUG("Have very long ack, total_bytes_received: %d\n", total_bytes_received);
-                    DEBUG("Bytes received: %d\n", bytes_received);
-                    int bytes = packets[idx].size() - sizeof(Header);
-                    total_bytes_received -= bytes;
-                    idx += 1;
+                ConstHeaderView in_header(in_batch.data(k));
+                PRINT_LOG_FROM_PACKET("RECV", in_batch.data(k), cc->cwnd(), cc->ssthresh(), 
+                        false);
+                if (checksum && !packet_checksum_ok(in_batch.data(k), in_batch.length(k))) {
+                    // corrupted, as if lost
+                    continue;
                 }
-                // ack new packets
-                new_ack_arrives(cwnd, ssthresh, dup_ack_count, MSS);
-            }
-            else {
-                // Duplicated ACK, ignore here, 
-                bool should_retransmit = dup_ack_arrives(cwnd, ssthresh, dup_ack_count, MSS);
-                if (should_retransmit) {
-                    int oldest_packet_idx = idx - inflight_packet_bytes.size();
-                    const std::vector<char>& retrans_packet = packets[oldest_packet_idx];
-                    send_packet(sockfd, server_addr, retrans_packet);
-                    print_log_from_packet("SEND", retrans_packet, cwnd, ssthresh, false);
+                int sack_count = 0;
+                if (sack) {
+                    sack_count = decode_sack_blocks(in_header.payload(), 
+                            in_batch.length(k) - in_header.size(), blocks);
+                }
+                if (fec && in_header.options_length() != 0) {
+                    HeaderOptions header_options;
+                    decode_header_options(in_header.options(), in_header.options_length(), 
+                            header_options);
+                    transfer_stats.recovered = std::max(transfer_stats.recovered, 
+                            (long) header_options.recovered);
+                }
+                if (seq_space.after(in_header.ack_number(), last_unacked_seq)) {
+                    // the window never exceeds half of the sequence space
+                    int acked_bytes = seq_space.distance(last_unacked_seq, in_header.ack_number());
+                    int total_bytes_received = acked_bytes;
+                    bytes_received += total_bytes_received;
+                    last_unacked_seq = in_header.ack_number();
+                    // pop out some inflight packets
+                    // TODO check if we need < 0 instead
+                    bool ambiguous = false;
+                    long sent_us = -1;
+                    while (total_bytes_received != 0 && !inflight_packets.empty()) {
+                        DEBUG("Poping out packets\n");
+                        const InflightPacket& packet = inflight_packets.front();
+                        total_bytes_received -= packet.bytes;
+                        ambiguous = ambiguous || packet.retransmitted;
+                        sent_us = packet.sent_us;
+                        if (!packet.sacked && !packet.lost) {
+                            bytes_inflight -= packet.bytes;
+                        }
+                        release_segment_timer(inflight_packets.front());
+                        inflight_packets.pop_front();
+                    }
+                    // sample RTT from the newest acknowledged packet, unless the ACK may be 
+                    // for a retransmission (Karn's rule)
+                    if (!ambiguous && sent_us >= 0) {
+                        long sample = now_us() - sent_us;
+                        rtt.add_sample(sample);
+                        cc->on_rtt_sample(sample, now_us());
+                    }
+                    else {
+                        // new data arrived, so the timeouts before are over even without a 
+                        // sample; otherwise the backoff adds up over recovery episodes
+                        rtt.reset_backoff();
+                    }
+                    // new ACK arrives, reset retransmission timer (no system call, unless 
+                    // it expires first)
+                    loop.start_timer(retrans_timer, rtt.rto_us());
+                    // in extreme case (w/ cumulative ACK), the ACK number may be very large 
+                    // and exceed the current queue, in this case, move window forward, so that
+                    // total_bytes_received == 0
+                    while (total_bytes_received != 0) {
+                        DEBUG("Have very long ack, total_bytes_received: %d\n", total_bytes_received);
+                        DEBUG("Bytes received: %d\n", bytes_received);
+                        int bytes = data_packet_payload(idx);
+                        total_bytes_received -= bytes;
+                        idx += 1;
+                    }
+                    release_parity(idx - inflight_packets.size());
+                    // ack new packets
+                    cc->on_ack(acked_bytes, now_us());
+                    mark_sacked(inflight_packets, bytes_inflight, idx, blocks, sack_count);
+                    if (in_recovery && idx - inflight_packets.size() >= recovery_point) {
+                        // everything sent before the loss is acknowledged
+                        in_recovery = false;
+                    }
+                    else if (in_recovery) {
+                        // partial ACK
+                        mark_lost(inflight_packets, bytes_inflight, false);
+                    }
+                }
+                else {
+                    // Duplicated ACK, ignore here, 
+                    mark_sacked(inflight_packets, bytes_inflight, idx, blocks, sack_count);
+                    bool should_retransmit = !fec_may_repair(idx - inflight_packets.size(), 
+                            blocks, sack_count) && cc->on_dup_ack(now_us());
+                    if (should_retransmit && !inflight_packets.empty() && !in_recovery) {
+                        int oldest_packet_idx = idx - inflight_packets.size();
+                        queue_data_packet(oldest_packet_idx);
+                        ++transfer_stats.retransmissions;
+                        inflight_packets.front().retransmitted = true;
+                        if (sack) {
+                            // start a recovery episode, repair every hole of the scoreboard
+                            in_recovery = true;
+                            recovery_point = idx;
+                            for (InflightPacket& packet : inflight_packets) {
+                                packet.recovered = false;
+                            }
+                            inflight_packets.front().recovered = true;
+                        }
+                    }
+                    if (in_recovery) {
+                        mark_lost(inflight_packets, bytes_inflight, false);
+                    }
+                }
+                // re-arrange inflight queue, SACK keeps the packets which were received
+                if (!sack) {
+                    rearrange_queue(inflight_packets, bytes_inflight, idx, cc->cwnd());
                 }
-                
             }
             // reset timeout timer, bc we have received message from server
-            reset_timer(timeout_timerfd, time_out);
+            loop.start_timer(timeout_timer, time_out_us);
         }
-        else if (fds[1].revents != 0) {
+        // the timer expired unless a new ACK restarted it
+        if (loop.expired_timer(retrans_timer)) {
             // retransmission timeout, change cwnd / ssthresh, then resend the oldest packet
-            timeout_arrives(cwnd, ssthresh, dup_ack_count, MSS);
-            int oldest_packet_idx = idx - inflight_packet_bytes.size();
-            const std::vector<char>& retrans_packet = packets[oldest_packet_idx];
-            send_packet(sockfd, server_addr, retrans_packet);
-            print_log_from_packet("SEND", retrans_packet, cwnd, ssthresh, false);
+            cc->on_timeout(now_us());
+            // parity packets sent so far are lost or useless by now
+            release_parity(next_new_packet);
+            if (sack) {
+                // every packet not SACKed is lost, they are retransmitted as the window opens
+                in_recovery = true;
+                recovery_point = idx;
+                for (InflightPacket& packet : inflight_packets) {
+                    packet.recovered = false;
+                }
+                mark_lost(inflight_packets, bytes_inflight, true);
+            }
+            else if (!inflight_packets.empty()) {
+                int oldest_packet_idx = idx - inflight_packets.size();
+                queue_data_packet(oldest_packet_idx);
+                ++transfer_stats.retransmissions;
+                inflight_packets.front().retransmitted = true;
+            }
+            // back off until a new packet is acknowledged
+            rtt.backoff();
+            loop.start_timer(retrans_timer, rtt.rto_us());
+        }
+        for (int timer : loop.expired_timers()) {
+            // timers of retransmitted packets, unless the packet was acknowledged meanwhile
+            if (timer != retrans_timer && timer != timeout_timer && timer != pacing_timer 
+                    && loop.expired_timer(timer)) {
+                segment_timeout(inflight_packets, bytes_inflight, idx, timer);
+            }
         }
-        else if (fds[2].revents != 0) {
+        if (loop.expired_timer(timeout_timer)) {
             // 10 sec timer
             release_resources();
             exit(EXIT_FAILURE); 
         }
-        else if (fds[3].revents != 0) {
+        if (loop.readable(sigfd)) {
             // signal caught
             release_resources();
             exit(0); //TODO check exit code
         }
         // re-arrange inflight queue
-        rearrange_queue(inflight_packet_bytes, bytes_inflight, idx, cwnd);
+        if (!sack) {
+            rearrange_queue(inflight_packets, bytes_inflight, idx, cc->cwnd());
+        }
     } 
 }
 
-void Client::close_connection(std::vector<char>& in_packet, Header& in_header, 
-        std::vector<char>& out_packet, Header& out_header, int& seq_number) {
-    write_fin_packet(out_packet, out_header, seq_number);
-    int expect_ack = (out_header.seq_number + 1) % max_seq_number;
-    reset_timer(timeout_timerfd, time_out);
+void Client::close_connection(char* in_packet, char* out_packet, uint32_t& seq_number) {
+    ConstHeaderView in_header(in_packet);
+    long start_us = now_us();
+    int out_length = write_fin_packet(out_packet, seq_number);
+    uint32_t expect_ack = seq_number;
+    loop.start_timer(timeout_timer, time_out_us);
     for (;;) {
         // send FIN packet
-        send_packet(sockfd, server_addr, out_packet);
-        print_log("SEND", out_header, cwnd, ssthresh, false);
-        reset_timer(retrans_timerfd, RTO);
-        int val = poll(fds, 4, -1);
-        if (val < 0) {
+        send_packet(*transport, server_addr, out_packet, out_length);
+        PRINT_LOG_FROM_PACKET("SEND", out_packet, cc->cwnd(), cc->ssthresh(), false);
+        loop.start_timer(retrans_timer, rtt.rto_us());
+        if (loop.wait() < 0) {
             // an error occurs
-            print_sys_error("Bad poll calling");
+            print_sys_error("Bad epoll calling");
+            release_resources();
+            exit(EXIT_FAILURE);
+        }
+        if (loop.readable(sigfd)) {
+            // signal caught
+            DEBUG("received termination signal, exiting...\n");
+            release_resources();
+            exit(EXIT_FAILURE);
+        }
+        if (loop.expired_timer(timeout_timer)) {
+            // timeout (>10 sec)
+            FATAL("Timeout (>10 sec), exiting...\n");
             release_resources();
             exit(EXIT_FAILURE);
         }
-        else if (fds[0].revents != 0) {
-            recv_packet(sockfd, server_addr, in_packet, in_header, max_packet_size);
-            print_log("RECV", in_header, cwnd, ssthresh, false);
-            if (in_header.ack && in_header.fin && in_header.ack_number == expect_ack) {
+        if (loop.readable(sockfd)) {
+            int in_length = recv_packet(sockfd, server_addr, in_packet, max_packet_size);
+            if (in_length < 0 || (checksum && !packet_checksum_ok(in_packet, in_length))) {
+                continue;
+            }
+            PRINT_LOG_FROM_PACKET("RECV", in_packet, cc->cwnd(), cc->ssthresh(), false);
+            if (in_header.ack() && in_header.fin() && in_header.ack_number() == expect_ack) {
                 // received a FIN-ACK packet, respond with ACK
-                int ack_number = (in_header.seq_number + 1) % max_seq_number;
-                write_fin_ack_packet(out_packet, out_header, seq_number, ack_number);
-                send_packet(sockfd, server_addr, out_packet);
-                print_log("SEND", out_header, cwnd, ssthresh, false);
+                uint32_t ack_number = seq_space.add(in_header.seq_number(), 1);
+                out_length = write_fin_ack_packet(out_packet, seq_number, ack_number);
+                send_packet(*transport, server_addr, out_packet, out_length);
+                PRINT_LOG_FROM_PACKET("SEND", out_packet, cc->cwnd(), cc->ssthresh(), false);
+                transfer_stats.close_us = now_us() - start_us;
+                if (checksum) {
+                    // the server wrote something else than the file
+                    HeaderOptions header_options;
+                    decode_header_options(in_header.options(), in_header.options_length(), 
+                            header_options);
+                    if (!header_options.has_digest || header_options.digest != file_digest) {
+                        FATAL("file digest %08x, the server wrote %08x\n", file_digest, 
+                                header_options.digest);
+                        release_resources();
+                        exit(EXIT_FAILURE);
+                    }
+                }
                 break;
             }
             // ignore this packet
             // reset timeout timer, bc we received a message
-            reset_timer(timeout_timerfd, time_out);
+            loop.start_timer(timeout_timer, time_out_us);
         }
-        else if (fds[1].revents != 0) {
+        else if (loop.expired_timer(retrans_timer)) {
             // retransmission timeout, resend FIN packet
+            rtt.backoff();
             continue;
         }
-        else if (fds[2].revents != 0) {
-            // timeout (>10 sec)
-            FATAL("Timeout (>10 sec), exiting...\n");
-            release_resources();
-            exit(EXIT_FAILURE);
-        }
-        else if (fds[3].revents != 0) {
-            // signal caught
-            DEBUG("received termination signal, exiting...\n");
-            release_resources();
-            exit(EXIT_FAILURE);
-        }
     }
     // respond to all FIN-ACK packets for 2 seconds
-    struct itimerspec time_for_fin;
-    struct timespec two_sec;
-    two_sec.tv_sec = 2;
-    two_sec.tv_nsec = 0;
-    memset(&time_for_fin, 0, sizeof(time_for_fin));
-    time_for_fin.it_value = two_sec;
+    loop.stop_timer(timeout_timer);
     // temprarily reuse retransmission timer for waiting
-    reset_timer(retrans_timerfd, time_for_fin);
+    loop.start_timer(retrans_timer, 2000000);
     for (;;) {
-        int val = poll(fds, 2, -1);
-        if (val < 0) {
+        if (loop.wait() < 0) {
             // an error occurs
-            print_sys_error("Bad poll calling");
+            print_sys_error("Bad epoll calling");
             release_resources();
             exit(EXIT_FAILURE);
         }
-        else if (fds[0].revents != 0) {
-            recv_packet(sockfd, server_addr, in_packet, in_header, max_packet_size);
-            print_log("RECV", in_header, cwnd, ssthresh, false);
-            if (in_header.fin && in_header.ack) {
+        if (loop.readable(sockfd) 
+                && recv_packet(sockfd, server_addr, in_packet, max_packet_size) >= 0) {
+            PRINT_LOG_FROM_PACKET("RECV", in_packet, cc->cwnd(), cc->ssthresh(), false);
+            if (in_header.fin() && in_header.ack()) {
                 // answer FIN-ACK packet
-                int ack_number = (in_header.seq_number + 1) % max_seq_number;
-                write_fin_ack_packet(out_packet, out_header, seq_number, ack_number);
-                send_packet(sockfd, server_addr, out_packet);
-                print_log("SEND", out_header, cwnd, ssthresh, false);
+                uint32_t ack_number = seq_space.add(in_header.seq_number(), 1);
+                out_length = write_fin_ack_packet(out_packet, seq_number, ack_number);
+                send_packet(*transport, server_addr, out_packet, out_length);
+                PRINT_LOG_FROM_PACKET("SEND", out_packet, cc->cwnd(), cc->ssthresh(), false);
             }
             // otherwise, not a fin packet, which will be ignored
         }
-        else if (fds[1].revents != 0) {
-            // 2 seconds timeout, exit the for loop
+        if (loop.expired_timer(retrans_timer) || loop.readable(sigfd)) {
+            // 2 seconds timeout or signal caught, exit the for loop
             break;
         }
     }
@@ -521,30 +1137,47 @@ void Client::close_connection(std::vector<char>& in_packet, Header& in_header,
 }
 
 
-// send message to server
-void Client::send_message(const std::vector<char>& message) {
-    // initialize a random sequence number
-    int seq_number = rand() % max_seq_number;
-    int expect_ack = (seq_number + 1) % max_seq_number;
-    std::vector<char> in_packet, out_packet;
-    Header in_header, out_header;
+// send the opened file to server
+void Client::send_message() {
+    // initialize a random sequence number, valid in both sequence spaces until the server 
+    // answers
+    uint32_t seq_number = rand() % max_seq_number;
+    uint32_t syn_seq = seq_number;
+    // control packets and their answers, data packets are built in the batch buffers
+    char* in_packet = pool.acquire();
+    char* out_packet = pool.acquire();
     
-    // hand-shaking period
-    write_syn_packet(out_packet, out_header, seq_number);
-    hand_shaking(out_packet, in_packet, in_header, expect_ack);
-    int ack_number = (in_header.seq_number + 1) % max_seq_number;
-    seq_number = expect_ack;
+    // hand-shaking period, which also picks the sequence space and the segment size
+    long start_us = now_us();
+    SynOptions syn_options;
+    syn_options.sack = options.sack;
+    syn_options.mss = max_packet_size - HEADER_SIZE;
+    syn_options.fec = options.fec_block > 0;
+    syn_options.checksum = options.checksum;
+    int out_length = write_syn_packet(out_packet, seq_number, syn_options, 0);
+    hand_shaking(out_packet, out_length, in_packet, syn_seq);
+    uint32_t ack_number = seq_space.add(ConstHeaderView(in_packet).seq_number(), 1);
+    pick_segment_size(in_packet, out_packet, syn_seq);
+    seq_number = seq_space.add(syn_seq, 1);
+    transfer_stats.handshake_us = now_us() - start_us;
     
-    // get all out-bounding packets
-    std::vector<std::vector<char> > data_packets;
-    std::vector<Header> data_headers;
-    write_data_packets(message, data_packets, data_headers, seq_number, ack_number);
-    int last_unacked_seq = data_headers[0].seq_number;
+    // out-bounding packets are built from the file when they are sent
+    first_data_seq = seq_number;
+    data_ack_number = ack_number;
+    size_t packet_count = count_data_packets();
+    uint32_t last_unacked_seq = seq_number;
+    seq_number = seq_space.add(seq_number, file.size());
     
     // extract sequence number and calculate next ack number
-    send_packets_in_window(last_unacked_seq, data_packets, in_packet, in_header); 
+    transfer_stats.bytes = file.size();
+    transfer_stats.segment = max_payload_size;
+    start_us = now_us();
+    send_packets_in_window(last_unacked_seq, packet_count); 
+    transfer_stats.transfer_us = now_us() - start_us;
 
     // send FIN -- FIN|ACK -- end
-    close_connection(in_packet, in_header, out_packet, out_header, seq_number);
+    close_connection(in_packet, out_packet, seq_number);
+    pool.release(in_packet);
+    pool.release(out_packet);
 }
 
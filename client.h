@@ -2,36 +2,143 @@
 #define _CLIENT_H_
 
 #include "packet.h"
+#include "file_reader.h"
+#include "batch_io.h"
+#include "transport.h"
+#include "rtt_estimator.h"
+#include "congestion_control.h"
+#include "seq_space.h"
+#include "event_loop.h"
+#include "packet_pool.h"
+#include "ring_queue.h"
+#include "fec.h"
+#include "checksum.h"
 #include <vector>
+#include <memory>
 #include <string>
-#include <deque>
 #include <arpa/inet.h> 
 #include <netinet/in.h> 
-#include <sys/timerfd.h>
-#include <poll.h>
+
+struct ClientOptions {
+    FileReadMode read_mode;
+    size_t read_chunk_size; // bytes read at once when not mapping the file
+    int batch_size;         // datagrams per sendmmsg/recvmmsg
+    bool gso;               // let the kernel segment runs of full-size packets (UDP GSO)
+    long min_rto_us;        // bounds of the retransmission timeout
+    long max_rto_us;
+    std::string congestion_control; // reno, cubic or bbr
+    bool sack;              // ask the server for selective acknowledgements
+    std::string pacing;     // "timer": spread packets at the pacing rate with a timer,
+                            // "fq": leave it to the fq qdisc (SO_MAX_PACING_RATE), 
+                            // "none": send the window in bursts
+    bool pmtud;             // probe the path MTU before picking the segment size, otherwise 
+                            // take the largest one both ends accept
+    NetemOptions netem;     // impairments of the packets sent, none by default
+    int fec_block;          // data packets of a FEC block, 0 disables forward error correction
+    int fec_parity;         // parity packets of a block, -1 follows the loss rate
+    bool checksum;          // CRC32C of every packet and of the file, if the server takes part
+
+    ClientOptions();
+};
+
+// data packet sent but not acknowledged yet
+struct InflightPacket {
+    int bytes;          // payload size
+    long sent_us;       // time of the latest transmission
+    bool retransmitted; // RTT can't be sampled from retransmitted packets
+    bool sacked;        // reported by a SACK block, no longer counted as in flight
+    bool lost;          // considered lost and not retransmitted yet, not counted as in flight
+    bool recovered;     // retransmitted during the current recovery episode
+    int timer;          // retransmission timer of the packet once retransmitted with SACK, 
+                        // -1 if none
+};
+
+typedef RingQueue<InflightPacket> InflightQueue;
+
+// counters of the latest transfer
+struct TransferStats {
+    long bytes;           // file size
+    int segment;          // payload of full data packets
+    long data_packets;    // data packets sent, retransmissions included
+    long retransmissions;
+    long parity_packets;  // FEC parity packets sent
+    long recovered;       // data packets the server rebuilt from parity packets
+    long handshake_us;    // first SYN until the segment size is picked
+    long transfer_us;     // first data packet until every byte is acknowledged
+    long close_us;        // first FIN until its FIN-ACK, without the final wait
+
+    TransferStats();
+};
 
 class Client {
 private:
-    int cwnd; // cwnd should be double, for cogestion avoidance
+    std::unique_ptr<CongestionControl> cc; // congestion window and pacing rate
     int max_cwnd;
-    int ssthresh;
     int MSS;
 
-    int max_seq_number;
+    int max_seq_number; // sequence space of legacy servers
     int max_packet_size;
+
+    uint8_t version;    // header version negotiated with SYN / SYN-ACK
+    SeqSpace seq_space; // sequence numbers of the version
+    bool sack;          // the server reports out-of-order data as SACK blocks
     
-    struct itimerspec RTO; 
-    struct itimerspec time_out;
+    RttEstimator rtt; // retransmission timeout
+    long time_out_us;
 
     int sockfd;  // socket
-    int retrans_timerfd; // retransmission timer
-    int timeout_timerfd; // timeout timer (to close the connection)
+    std::unique_ptr<Transport> transport; // packets leave the socket through it
     int sigfd; // catch the signal
-    struct pollfd fds[4];
+    EventLoop loop; // socket, signal and timers
+    int retrans_timer; // retransmission timer
+    int timeout_timer; // timeout timer (to close the connection)
+    std::vector<size_t> segment_packets; // packet index of each per-packet timer, by timer id
+    int pacing_timer;  // the next packet may leave when it expires
+    long next_send_us; // earliest time of the next data packet with timer pacing
+    long fq_rate;      // latest SO_MAX_PACING_RATE
     struct sockaddr_in server_addr;
+
+    ClientOptions options;
+
+    // data packets are built on demand from the file being sent
+    FileReader file;
+    int max_payload_size; // segment size, payload of full data packets
+    SynOptions server_options; // options of the latest SYN-ACK
+    size_t window_packets;   // packets the server buffers from the oldest unacknowledged one
+    uint32_t first_data_seq; // sequence number of the first data packet
+    uint32_t data_ack_number; // ack number carried by data packets
+    size_t next_new_packet;  // next data packet sent for the first time
+
+    // forward error correction: blocks of full data packets are followed by parity packets 
+    // when they are sent for the first time, the server rebuilds lost data packets from them
+    bool fec;                // negotiated with SYN / SYN-ACK
+    FecEncoder fec_encoder;  // parity of the latest block
+    std::vector<uint8_t> fec_parity; // parity packets of each block sent so far
+    double fec_loss_rate;    // losses per data packet, moving average over blocks
+    long fec_losses;         // retransmissions and rebuilt packets when the latest block began
+    size_t fec_acked_block;  // oldest block whose parity packets still count as in flight
+    int fec_bytes_inflight;  // parity bytes sent and not yet acknowledged
+
+    // packets after SYN carry their CRC32C, FIN the one of the data sent for the first time
+    bool checksum;           // negotiated with SYN / SYN-ACK
+    uint32_t file_digest;    // CRC32C of the data packets before next_new_packet
+    std::unique_ptr<Crc32cShift> segment_shift; // extends file_digest by a full segment
+
+    PacketBatch out_batch; // data packets waiting to be sent
+    PacketBatch in_batch;  // received ACK packets
+    PacketPool pool;       // SYN, FIN and their answers
+
+    TransferStats transfer_stats;
     
-    void hand_shaking(const std::vector<char>& packet, std::vector<char>& reply, 
-            Header& header, int expect_ack);
+    void hand_shaking(const char* packet, int length, char* reply, uint32_t syn_seq);
+
+    void wait_handshake_event();
+
+    void pick_segment_size(char* in_packet, char* out_packet, uint32_t syn_seq);
+
+    int probe_path_mtu(int limit, char* in_packet, char* out_packet, uint32_t syn_seq);
+
+    void confirm_segment_size(int segment, char* in_packet, char* out_packet, uint32_t syn_seq);
     
     void catch_signal();
     
@@ -39,41 +146,74 @@ private:
     
     //void state_transition(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS, int event);
     
-    void new_ack_arrives(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS);
+    void rearrange_queue(InflightQueue& inflight_packets, int& bytes_inflight, 
+            size_t& idx, int cwnd);
+
+    void mark_sacked(InflightQueue& inflight_packets, int& bytes_inflight, 
+            size_t idx, const SackBlock* blocks, int count);
+
+    void mark_lost(InflightQueue& inflight_packets, int& bytes_inflight, bool all);
+
+    void retransmit_lost(InflightQueue& inflight_packets, int& bytes_inflight, 
+            size_t idx);
 
-    bool dup_ack_arrives(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS); 
+    void start_segment_timer(InflightPacket& packet, size_t packet_idx);
 
-    void timeout_arrives(int& cwnd, int& ssthresh, int& dup_ack_count, int MSS);
+    void release_segment_timer(InflightPacket& packet);
 
-    void rearrange_queue(std::deque<int>& inflight_packet_bytes, int& bytes_inflight, size_t& idx, 
-            int cwnd);
+    void segment_timeout(InflightQueue& inflight_packets, int& bytes_inflight, 
+            size_t idx, int timer);
 
-    void send_message(const std::vector<char>& message);
+    bool pace(int bytes);
+
+    void update_pacing_rate();
+
+    void send_message();
     
-    void send_packets_in_window(int last_unacked_seq, const std::vector<std::vector<char> >& packets, 
-            std::vector<char>& in_packet, Header& in_header);
+    void send_packets_in_window(uint32_t last_unacked_seq, size_t packet_count);
+
+    void queue_data_packet(size_t idx);
+
+    void flush_packets();
     
-    void close_connection(std::vector<char>& in_packet, Header& in_header, 
-            std::vector<char>& out_packet, Header& out_header, int& seq_number); 
+    void close_connection(char* in_packet, char* out_packet, uint32_t& seq_number); 
 
-    void write_syn_packet(std::vector<char>& packet, Header& header, int& seq_number);
+    // packets are built in place, the functions return their size
+    int write_syn_packet(char* packet, uint32_t seq_number, const SynOptions& syn_options, 
+            int length);
     
-    void write_ack_packet(const char* message, int length, std::vector<char>& packet, 
-            Header& header, int& seq_number, int ack_number);
+    int write_ack_packet(size_t offset, int length, char* packet, uint32_t& seq_number, 
+            uint32_t ack_number, const HeaderOptions& header_options);
     
-    void write_fin_packet(std::vector<char>& packet, Header& header, int& seq_number);
+    int write_fin_packet(char* packet, uint32_t& seq_number);
     
-    void write_fin_ack_packet(std::vector<char>& packet, Header& header, int seq_number, 
-            int ack_number);
+    int write_fin_ack_packet(char* packet, uint32_t seq_number, uint32_t ack_number);
     
-    void write_data_packets(const std::vector<char>& message, 
-            std::vector<std::vector<char> >& packets, std::vector<Header>& headers, 
-            int& seq_number, int ack_number);
+    size_t count_data_packets() const;
+
+    int data_packet_payload(size_t idx) const;
+
+    int write_data_packet(size_t idx, char* packet);
+
+    int data_header_size() const;
+
+    int fec_block_size(size_t idx) const;
+
+    void start_fec_block(size_t idx);
+
+    void queue_parity_packets(size_t first_idx);
+
+    bool fec_may_repair(size_t idx, const SackBlock* blocks, int count) const;
+
+    void release_parity(size_t acked);
 public:
     Client(const std::string& server_addr, int server_port, int max_seq_number, int max_packet_size, 
-            int cwnd, int max_cwnd, int ssthresh, int MSS); 
+            int cwnd, int max_cwnd, int ssthresh, int MSS, 
+            const ClientOptions& options = ClientOptions()); 
     
     void send_file(const std::string& file_path);
+
+    const TransferStats& stats() const { return transfer_stats; }
 };
 
 #endif
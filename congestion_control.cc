@@ -0,0 +1,337 @@
+#include "congestion_control.h"
+// C++ headers
+#include <algorithm>
+// C headers
+#include <cmath>
+#include <climits>
+
+CongestionControl::CongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd) 
+    : window(cwnd), threshold(ssthresh), MSS(MSS), max_window(max_cwnd), dup_ack_count(0), 
+    sack(false), srtt_us(-1), min_rtt_us(-1) {
+}
+
+bool CongestionControl::on_dup_ack(long now_us) {
+    dup_ack_count += 1;
+    if (dup_ack_count == 3) {
+        on_loss(now_us);
+        return true;
+    }
+    return false;
+}
+
+void CongestionControl::on_rtt_sample(long rtt_us, long now_us) {
+    srtt_us = srtt_us < 0 ? rtt_us : (7 * srtt_us + rtt_us) / 8;
+    min_rtt_us = min_rtt_us < 0 ? rtt_us : std::min(min_rtt_us, rtt_us);
+}
+
+long CongestionControl::window_rate() const {
+    if (srtt_us <= 0) {
+        return 0;
+    }
+    return (long) window * 1000000 / srtt_us;
+}
+
+long CongestionControl::pacing_rate() const {
+    return (long) ((window < threshold ? 2 : 1.2) * window_rate());
+}
+
+void CongestionControl::limit_window(long bytes) {
+    max_window = (int) std::min((long) max_window, std::min(bytes, (long) INT_MAX));
+    clamp();
+}
+
+void CongestionControl::set_mss(int mss) {
+    window = (long) window * mss / MSS;
+    threshold = (long) threshold * mss / MSS;
+    max_window = std::min((long) max_window * mss / MSS, (long) INT_MAX);
+    MSS = mss;
+    clamp();
+}
+
+void CongestionControl::clamp() {
+    window = std::max(MSS, std::min(window, max_window));
+}
+
+
+RenoCongestionControl::RenoCongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd) 
+    : CongestionControl(cwnd, ssthresh, MSS, max_cwnd), bytes_acked(0) {
+}
+
+// new ACK arrives
+void RenoCongestionControl::on_ack(int acked_bytes, long now_us) {
+    // check whether slow start or congestion avoidance
+    if (dup_ack_count >= 3) {
+        // if in fast retransmission mode, when meeting a new ACK, set cwnd = ssthresh
+        window = threshold;
+    }
+    else if (window >= threshold) {
+        // congestion avoidance, one MSS per window of acknowledged bytes
+        bytes_acked += acked_bytes;
+        if (bytes_acked >= window) {
+            bytes_acked -= window;
+            window += MSS;
+        }
+    }
+    else {
+        // slow start mode, the acknowledged bytes up to 2 MSS per ACK (L = 2)
+        window += std::min(acked_bytes, 2 * MSS);
+    }
+    dup_ack_count = 0;
+    window = std::min(window, max_window);
+}
+
+// duplicated ACK arrives
+bool RenoCongestionControl::on_dup_ack(long now_us) {
+    bool should_retransmit = CongestionControl::on_dup_ack(now_us);
+    if (dup_ack_count > 3 && !sack) {
+        // receiving more duplicated acks
+        window += MSS;
+    }
+    window = std::min(window, max_window);
+    return should_retransmit;
+}
+
+void RenoCongestionControl::on_loss(long now_us) {
+    // enter fast recovery mode for the first time
+    threshold = std::max(window / 2, 1024);
+    window = sack ? threshold : threshold + 3 * MSS;
+    bytes_acked = 0;
+}
+
+// timeout
+void RenoCongestionControl::on_timeout(long now_us) {
+    threshold = std::max(window / 2, 1024);
+    window = MSS;
+    dup_ack_count = 0;
+    bytes_acked = 0;
+}
+
+
+static const double CUBIC_C = 0.4;
+static const double CUBIC_BETA = 0.7;
+
+CubicCongestionControl::CubicCongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd) 
+    : CongestionControl(cwnd, ssthresh, MSS, max_cwnd), w_max(0), w_est(0), k(0), 
+    epoch_start_us(0), cwnd_fraction(0) {
+}
+
+void CubicCongestionControl::on_ack(int acked_bytes, long now_us) {
+    if (dup_ack_count >= 3) {
+        // leave fast recovery
+        dup_ack_count = 0;
+        window = threshold;
+        clamp();
+        return;
+    }
+    dup_ack_count = 0;
+    if (window < threshold) {
+        // slow start
+        window += acked_bytes;
+        clamp();
+        return;
+    }
+    double cwnd = (double) window / MSS;
+    double acked = (double) acked_bytes / MSS;
+    if (epoch_start_us == 0) {
+        epoch_start_us = now_us;
+        if (cwnd < w_max) {
+            k = std::cbrt((w_max - cwnd) / CUBIC_C);
+        }
+        else {
+            k = 0;
+            w_max = cwnd;
+        }
+        w_est = cwnd;
+    }
+    // window one RTT from now on the cubic curve, growing at most by half a window
+    double t = (now_us - epoch_start_us + std::max(min_rtt_us, 0L)) / 1e6;
+    double target = std::min(CUBIC_C * std::pow(t - k, 3) + w_max, 1.5 * cwnd);
+    double increase = target > cwnd ? (target - cwnd) / cwnd * acked : 0.01 * acked / cwnd;
+    // TCP-friendly region: never grow slower than Reno with the same reduction
+    w_est += 3 * (1 - CUBIC_BETA) / (1 + CUBIC_BETA) * acked / cwnd;
+    increase = std::max(increase, w_est - cwnd);
+    cwnd_fraction += increase * MSS;
+    int bytes = (int) cwnd_fraction;
+    window += bytes;
+    cwnd_fraction -= bytes;
+    clamp();
+}
+
+bool CubicCongestionControl::on_dup_ack(long now_us) {
+    bool should_retransmit = CongestionControl::on_dup_ack(now_us);
+    if (dup_ack_count > 3 && !sack) {
+        // every duplicated ACK means one more packet has left the network
+        window += MSS;
+        clamp();
+    }
+    return should_retransmit;
+}
+
+void CubicCongestionControl::reduce() {
+    epoch_start_us = 0;
+    cwnd_fraction = 0;
+    double cwnd = (double) window / MSS;
+    // fast convergence: release bandwidth for new flows
+    w_max = cwnd < w_max ? cwnd * (1 + CUBIC_BETA) / 2 : cwnd;
+    threshold = std::max((int) (window * CUBIC_BETA), 2 * MSS);
+}
+
+void CubicCongestionControl::on_loss(long now_us) {
+    reduce();
+    window = sack ? threshold : threshold + 3 * MSS;
+    clamp();
+}
+
+void CubicCongestionControl::on_timeout(long now_us) {
+    reduce();
+    window = MSS;
+    dup_ack_count = 0;
+}
+
+
+static const double BBR_HIGH_GAIN = 2.885; // 2/ln(2), doubles the sending rate every round
+static const double BBR_CYCLE_GAINS[] = {1.25, 0.75, 1, 1, 1, 1, 1, 1};
+static const int BBR_CYCLE_LENGTH = sizeof(BBR_CYCLE_GAINS) / sizeof(BBR_CYCLE_GAINS[0]);
+static const long BBR_MIN_RTT_WINDOW_US = 10000000; // 10 sec
+static const long BBR_PROBE_RTT_US = 200000;        // 200 ms
+
+BbrCongestionControl::BbrCongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd) 
+    : CongestionControl(cwnd, ssthresh, MSS, max_cwnd), mode(STARTUP), 
+    pacing_gain(BBR_HIGH_GAIN), cwnd_gain(BBR_HIGH_GAIN), delivered(0), round_start_us(0), 
+    round_delivered(0), round_count(0), full_bw(0), full_bw_rounds(0), cycle_index(0), 
+    min_rtt_stamp_us(0), probe_rtt_done_us(0) {
+    std::fill(bw_samples, bw_samples + BW_ROUNDS, 0.0);
+}
+
+double BbrCongestionControl::bottleneck_bw() const {
+    return *std::max_element(bw_samples, bw_samples + BW_ROUNDS);
+}
+
+// estimated bandwidth-delay product in bytes, 0 if unknown
+long BbrCongestionControl::bdp() const {
+    if (min_rtt_us <= 0) {
+        return 0;
+    }
+    return (long) (bottleneck_bw() * min_rtt_us / 1e6);
+}
+
+void BbrCongestionControl::on_rtt_sample(long rtt_us, long now_us) {
+    bool expired = min_rtt_us >= 0 && now_us - min_rtt_stamp_us > BBR_MIN_RTT_WINDOW_US;
+    CongestionControl::on_rtt_sample(rtt_us, now_us);
+    if (expired || rtt_us <= min_rtt_us) {
+        min_rtt_us = rtt_us;
+        min_rtt_stamp_us = now_us;
+    }
+    if (expired && mode != PROBE_RTT) {
+        // drain the queue to measure the propagation delay again
+        mode = PROBE_RTT;
+        pacing_gain = 1;
+        probe_rtt_done_us = now_us + std::max(BBR_PROBE_RTT_US, min_rtt_us);
+    }
+}
+
+void BbrCongestionControl::end_round(long now_us) {
+    // delivery rate of the round
+    double seconds = (now_us - round_start_us) / 1e6;
+    bw_samples[round_count % BW_ROUNDS] = (delivered - round_delivered) / seconds;
+    round_count += 1;
+    round_start_us = now_us;
+    round_delivered = delivered;
+
+    double bw = bottleneck_bw();
+    switch (mode) {
+    case STARTUP:
+        // the pipe is full when bandwidth stops growing by 25% for three rounds
+        if (bw >= full_bw * 1.25) {
+            full_bw = bw;
+            full_bw_rounds = 0;
+        }
+        else if (++full_bw_rounds >= 3) {
+            mode = DRAIN;
+            pacing_gain = 1 / BBR_HIGH_GAIN;
+        }
+        break;
+    case DRAIN:
+        // one round at a low rate drains the queue built during startup
+        mode = PROBE_BW;
+        cwnd_gain = 2;
+        cycle_index = 0;
+        pacing_gain = BBR_CYCLE_GAINS[cycle_index];
+        break;
+    case PROBE_BW:
+        cycle_index = (cycle_index + 1) % BBR_CYCLE_LENGTH;
+        pacing_gain = BBR_CYCLE_GAINS[cycle_index];
+        break;
+    case PROBE_RTT:
+        if (now_us >= probe_rtt_done_us) {
+            mode = PROBE_BW;
+            cwnd_gain = 2;
+            pacing_gain = BBR_CYCLE_GAINS[cycle_index];
+        }
+        break;
+    }
+}
+
+void BbrCongestionControl::update_window() {
+    long target = (long) (cwnd_gain * bdp());
+    if (mode == PROBE_RTT) {
+        window = 4 * MSS;
+    }
+    else if (target > 0 && mode != STARTUP) {
+        window = (int) std::min(target, (long) window);
+    }
+    window = std::max(window, 4 * MSS);
+    clamp();
+    // reported as ssthresh in the logs
+    threshold = (int) std::min(bdp(), (long) max_window);
+}
+
+void BbrCongestionControl::on_ack(int acked_bytes, long now_us) {
+    dup_ack_count = 0;
+    delivered += acked_bytes;
+    if (round_start_us == 0) {
+        round_start_us = now_us;
+        round_delivered = delivered - acked_bytes;
+    }
+    // a round lasts one minimum RTT
+    if (min_rtt_us > 0 && now_us - round_start_us >= min_rtt_us) {
+        end_round(now_us);
+    }
+    // grow by the acknowledged bytes, up to the target window once the pipe is full
+    window += acked_bytes;
+    update_window();
+}
+
+void BbrCongestionControl::on_loss(long now_us) {
+    // the model, not the loss, limits the window
+}
+
+void BbrCongestionControl::on_timeout(long now_us) {
+    window = 4 * MSS;
+    dup_ack_count = 0;
+    round_start_us = 0;
+    clamp();
+}
+
+long BbrCongestionControl::pacing_rate() const {
+    double bw = bottleneck_bw();
+    if (bw <= 0) {
+        return (long) (pacing_gain * window_rate());
+    }
+    return (long) (pacing_gain * bw);
+}
+
+
+CongestionControl* create_congestion_control(const std::string& name, int cwnd, int ssthresh, 
+        int MSS, int max_cwnd) {
+    if (name == "reno") {
+        return new RenoCongestionControl(cwnd, ssthresh, MSS, max_cwnd);
+    }
+    if (name == "cubic") {
+        return new CubicCongestionControl(cwnd, ssthresh, MSS, max_cwnd);
+    }
+    if (name == "bbr") {
+        return new BbrCongestionControl(cwnd, ssthresh, MSS, max_cwnd);
+    }
+    return NULL;
+}
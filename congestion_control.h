@@ -0,0 +1,168 @@
+#ifndef _CONGESTION_CONTROL_H_
+#define _CONGESTION_CONTROL_H_
+
+#include <string>
+
+// Congestion controller of the sender. The sender reports events through the hooks, then
+// reads back the congestion window (bytes) and the pacing rate (bytes per second).
+class CongestionControl {
+public:
+    CongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd);
+
+    virtual ~CongestionControl() {}
+
+    virtual const char* name() const = 0;
+
+    // new data is acknowledged (cumulatively)
+    virtual void on_ack(int acked_bytes, long now_us) = 0;
+
+    // duplicated ACK, returns true if the oldest packet should be retransmitted now
+    virtual bool on_dup_ack(long now_us);
+
+    // fast retransmit, called by on_dup_ack() on the third duplicated ACK
+    virtual void on_loss(long now_us) = 0;
+
+    // retransmission timeout
+    virtual void on_timeout(long now_us) = 0;
+
+    // RTT measured from a packet that was not retransmitted
+    virtual void on_rtt_sample(long rtt_us, long now_us);
+
+    int cwnd() const { return window; }
+
+    int ssthresh() const { return threshold; }
+
+    // the window can't exceed `bytes`, e.g. the receive window of the peer; windows beyond 
+    // INT_MAX (half of the 32-bit sequence space) are capped there
+    void limit_window(long bytes);
+
+    // segments of `mss` bytes are sent from now on, the window, threshold and window cap 
+    // keep their size in segments; call before any data is sent
+    void set_mss(int mss);
+
+    // with SACK the sender takes packets which left the network out of flight itself, so fast
+    // recovery must not inflate the window for them
+    void use_sack(bool on) { sack = on; }
+
+    // 0 until an RTT is known, which means sending the window without pacing; window based
+    // controllers pace at cwnd / SRTT, twice as fast in slow start and 1.2 times in 
+    // congestion avoidance so that pacing doesn't hold the window back
+    virtual long pacing_rate() const;
+
+protected:
+    int window;     // congestion window in bytes
+    int threshold;  // slow start threshold in bytes
+    int MSS;
+    int max_window;
+    int dup_ack_count;
+    bool sack;
+    long srtt_us;    // smoothed RTT, -1 before the first sample
+    long min_rtt_us; // -1 before the first sample
+
+    void clamp();
+
+    // cwnd / SRTT, 0 before the first sample
+    long window_rate() const;
+};
+
+// TCP Reno with fast recovery, the original behavior of the client. The window grows by the
+// acknowledged bytes (RFC 3465), so ACKs covering several packets grow it as much as one ACK
+// per packet would
+class RenoCongestionControl : public CongestionControl {
+public:
+    RenoCongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd);
+
+    const char* name() const { return "reno"; }
+
+    void on_ack(int acked_bytes, long now_us);
+
+    bool on_dup_ack(long now_us);
+
+    void on_loss(long now_us);
+
+    void on_timeout(long now_us);
+
+private:
+    int bytes_acked; // acknowledged in congestion avoidance since the window last grew
+};
+
+// CUBIC (RFC 8312): the window grows with a cubic function of the time since the last loss,
+// and never slower than Reno would
+class CubicCongestionControl : public CongestionControl {
+public:
+    CubicCongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd);
+
+    const char* name() const { return "cubic"; }
+
+    void on_ack(int acked_bytes, long now_us);
+
+    bool on_dup_ack(long now_us);
+
+    void on_loss(long now_us);
+
+    void on_timeout(long now_us);
+
+private:
+    double w_max;       // window before the last reduction, in segments
+    double w_est;       // window Reno would have, in segments
+    double k;           // seconds to reach w_max again
+    long epoch_start_us; // start of the current congestion avoidance epoch, 0 if none
+    double cwnd_fraction; // growth not yet added to the window, in bytes
+
+    void reduce();
+};
+
+// Model-based controller in the spirit of BBR: estimates bottleneck bandwidth (windowed max 
+// of delivery rate) and propagation delay (windowed min of RTT), and sets the window to a 
+// multiple of their product and the pacing rate to a multiple of the bandwidth. Losses do
+// not reduce the window.
+class BbrCongestionControl : public CongestionControl {
+public:
+    BbrCongestionControl(int cwnd, int ssthresh, int MSS, int max_cwnd);
+
+    const char* name() const { return "bbr"; }
+
+    void on_ack(int acked_bytes, long now_us);
+
+    void on_loss(long now_us);
+
+    void on_timeout(long now_us);
+
+    void on_rtt_sample(long rtt_us, long now_us);
+
+    long pacing_rate() const;
+
+private:
+    enum Mode { STARTUP, DRAIN, PROBE_BW, PROBE_RTT };
+
+    static const int BW_ROUNDS = 10;
+
+    Mode mode;
+    double pacing_gain;
+    double cwnd_gain;
+
+    long delivered;           // bytes acknowledged so far
+    long round_start_us;      // start of the current round trip
+    long round_delivered;     // delivered at the start of the round
+    long round_count;
+    double bw_samples[BW_ROUNDS]; // delivery rate of recent rounds, bytes per second
+    double full_bw;           // bandwidth when startup last grew by 25%
+    int full_bw_rounds;       // rounds without such growth
+    int cycle_index;          // phase of the PROBE_BW gain cycle
+    long min_rtt_stamp_us;    // when min_rtt_us was measured
+    long probe_rtt_done_us;   // end of PROBE_RTT
+
+    double bottleneck_bw() const;
+
+    long bdp() const;
+
+    void end_round(long now_us);
+
+    void update_window();
+};
+
+// `name` is reno, cubic or bbr, returns NULL for an unknown name
+CongestionControl* create_congestion_control(const std::string& name, int cwnd, int ssthresh, 
+        int MSS, int max_cwnd);
+
+#endif
@@ -0,0 +1,41 @@
+// Print a binary event log (written with --log=FILE) in the text format of the SEND/RECV 
+// logs, e.g. for printFigure.py.
+//
+// usage: ./decode_log <LOG_FILE>
+
+// project headers
+#include "event_log.h"
+#include "utils.h"
+// C headers
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+int main(int argc, char** argv) {
+    if (argc != 2) {
+        FATAL("invalid number of parameters,\nshould be `./decode_log <LOG_FILE>`\n");
+        exit(EXIT_FAILURE);
+    }
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        print_sys_error("Unable to open event log");
+        exit(EXIT_FAILURE);
+    }
+    char magic[sizeof(LOG_MAGIC)];
+    if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) 
+            || memcmp(magic, LOG_MAGIC, sizeof(magic)) != 0) {
+        FATAL("not an event log: %s\n", argv[1]);
+        exit(EXIT_FAILURE);
+    }
+    LogRecord records[1024];
+    char line[128];
+    size_t n;
+    while ((n = fread(records, sizeof(LogRecord), 1024, file)) != 0) {
+        for (size_t i = 0; i != n; ++i) {
+            format_log_record(records[i], line, sizeof(line));
+            fputs(line, stdout);
+        }
+    }
+    fclose(file);
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "event_log.h"
+// C headers
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+// C++ headers
+#include <algorithm>
+#include <chrono>
+// LINUX headers
+#include <unistd.h>
+#include <fcntl.h>
+
+const char LOG_MAGIC[8] = {'T', 'C', 'P', 'L', 'O', 'G', '1', '\n'};
+
+LogRecord make_log_record(LogDirection direction, const Header& header, int cwnd, int ssthresh, 
+        bool dup, long time_us) {
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.time_us = time_us;
+    record.seq_number = header.seq_number;
+    record.ack_number = header.ack_number;
+    record.cwnd = cwnd;
+    record.ssthresh = ssthresh;
+    record.direction = direction;
+    record.flags = (header.ack ? LOG_ACK : 0) | (header.syn ? LOG_SYN : 0) 
+        | (header.fin ? LOG_FIN : 0) | (dup ? LOG_DUP : 0);
+    return record;
+}
+
+// RECV <SeqNum> <AckNum> <cwnd> <ssthresh> [ACK] [SYN] [FIN]
+// SEND <SeqNum> <AckNum> <cwnd> <ssthresh> [ACK] [SYN] [FIN] [DUP]
+int format_log_record(const LogRecord& record, char* line, size_t size) {
+    const char* state = "";
+    if (record.flags & LOG_ACK) {
+        state = (record.flags & LOG_SYN) ? "ACK SYN" : (record.flags & LOG_FIN) ? "ACK FIN" 
+            : "ACK";
+    }
+    else {
+        state = (record.flags & LOG_SYN) ? " SYN" : (record.flags & LOG_FIN) ? " FIN" : "";
+    }
+    return snprintf(line, size, "%s %u %u %d %d %s%s\n", 
+            record.direction == LOG_SEND ? "SEND" : "RECV", record.seq_number, 
+            record.ack_number, record.cwnd, record.ssthresh, state, 
+            (record.flags & LOG_DUP) ? " DUP" : "");
+}
+
+static size_t round_up_pow2(size_t n) {
+    size_t p = 1;
+    while (p < n) {
+        p <<= 1;
+    }
+    return p;
+}
+
+EventLog::EventLog(size_t capacity) : records(round_up_pow2(capacity)), 
+    mask(records.size() - 1), head(0), tail(0), running(false), fd(-1) {
+}
+
+EventLog::~EventLog() {
+    close();
+}
+
+int EventLog::open(const std::string& path) {
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+    if (write(fd, LOG_MAGIC, sizeof(LOG_MAGIC)) != sizeof(LOG_MAGIC)) {
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+    running = true;
+    drainer = std::thread(&EventLog::drain_loop, this);
+    return 0;
+}
+
+void EventLog::append(const LogRecord& record) {
+    size_t h = head.load(std::memory_order_relaxed);
+    // wait for the drain thread rather than losing records
+    while (h - tail.load(std::memory_order_acquire) == records.size()) {
+        std::this_thread::yield();
+    }
+    records[h & mask] = record;
+    head.store(h + 1, std::memory_order_release);
+}
+
+size_t EventLog::drain() {
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t count = h - t;
+    while (t != h) {
+        // contiguous part of the ring
+        size_t n = std::min(h - t, records.size() - (t & mask));
+        const char* data = (const char*) &records[t & mask];
+        size_t bytes = n * sizeof(LogRecord);
+        while (bytes != 0) {
+            ssize_t written = write(fd, data, bytes);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written < 0) {
+                // keep consuming, the producer must not wait for a broken file
+                perror("Unable to write event log");
+                break;
+            }
+            data += written;
+            bytes -= written;
+        }
+        t += n;
+        tail.store(t, std::memory_order_release);
+    }
+    return count;
+}
+
+void EventLog::drain_loop() {
+    while (running.load(std::memory_order_acquire)) {
+        if (drain() == 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+void EventLog::close() {
+    if (fd == -1) {
+        return;
+    }
+    running = false;
+    if (drainer.joinable()) {
+        drainer.join();
+    }
+    drain();
+    ::close(fd);
+    fd = -1;
+}
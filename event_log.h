@@ -0,0 +1,83 @@
+#ifndef _EVENT_LOG_H_
+#define _EVENT_LOG_H_
+
+#include "packet.h"
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+enum LogDirection {
+    LOG_SEND = 0,
+    LOG_RECV = 1
+};
+
+enum LogFlag {
+    LOG_ACK = 1,
+    LOG_SYN = 2,
+    LOG_FIN = 4,
+    LOG_DUP = 8
+};
+
+// one SEND/RECV line of the log, as written to the binary log file
+struct LogRecord {
+    int64_t time_us;    // monotonic clock
+    uint32_t seq_number;
+    uint32_t ack_number;
+    int32_t cwnd;
+    int32_t ssthresh;
+    uint8_t direction;  // LogDirection
+    uint8_t flags;      // LogFlag bits
+    uint8_t padding[6];
+};
+
+// first bytes of a binary log file
+extern const char LOG_MAGIC[8];
+
+LogRecord make_log_record(LogDirection direction, const Header& header, int cwnd, int ssthresh, 
+        bool dup, long time_us);
+
+// write the text form of the record (the format of print_log(), with a trailing newline), 
+// returns its length
+int format_log_record(const LogRecord& record, char* line, size_t size);
+
+// Binary event log off the hot path: the (single) producer thread copies fixed-size records 
+// into a lock-free ring, a background thread drains the ring to the log file. The producer 
+// only waits if the ring is full.
+class EventLog {
+public:
+    // capacity is rounded up to a power of two
+    explicit EventLog(size_t capacity);
+
+    ~EventLog();
+
+    EventLog(const EventLog&) = delete;
+
+    EventLog& operator=(const EventLog&) = delete;
+
+    // create the log file and start draining, -1 on error
+    int open(const std::string& path);
+
+    void append(const LogRecord& record);
+
+    // stop the background thread and write the remaining records
+    void close();
+
+private:
+    std::vector<LogRecord> records;
+    size_t mask;
+    alignas(64) std::atomic<size_t> head; // next record to write, owned by the producer
+    alignas(64) std::atomic<size_t> tail; // next record to drain, owned by the drain thread
+    alignas(64) std::atomic<bool> running;
+    int fd;
+    std::thread drainer;
+
+    // write the records available now, returns how many were written
+    size_t drain();
+
+    void drain_loop();
+};
+
+#endif
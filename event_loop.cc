@@ -0,0 +1,144 @@
+#include "event_loop.h"
+#include "utils.h"
+// C headers
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+// C++ headers
+#include <algorithm>
+// LINUX headers
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+static const int MAX_EVENTS = 64;
+// granularity of timers, well below the minimum RTO
+static const long TICK_US = 100;
+
+EventLoop::EventLoop() : armed_us(0), wheel(TICK_US, now_us()) {
+    epfd = epoll_create1(0);
+    timerfd = timerfd_create(CLOCK_MONOTONIC, O_NONBLOCK);
+    if (epfd == -1 || timerfd == -1 || add(timerfd) == -1) {
+        print_sys_error("Unable to create event loop");
+        exit(EXIT_FAILURE);
+    }
+}
+
+EventLoop::~EventLoop() {
+    close(timerfd);
+    close(epfd);
+}
+
+int EventLoop::add(int fd) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event);
+}
+
+void EventLoop::remove(int fd) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+int EventLoop::create_timer() {
+    int timer = wheel.create();
+    if (timer >= (int) fired.size()) {
+        fired.resize(timer + 1);
+    }
+    fired[timer] = false;
+    return timer;
+}
+
+void EventLoop::destroy_timer(int timer) {
+    fired[timer] = false;
+    wheel.destroy(timer);
+}
+
+void EventLoop::start_timer(int timer, long delay_us) {
+    long deadline_us = now_us() + delay_us;
+    fired[timer] = false;
+    wheel.start(timer, deadline_us);
+    // the kernel timer only moves if this is the new earliest deadline
+    if (armed_us == 0 || deadline_us < armed_us) {
+        arm();
+    }
+}
+
+void EventLoop::stop_timer(int timer) {
+    // the kernel timer stays armed, an early wake up costs less than re-arming
+    fired[timer] = false;
+    wheel.stop(timer);
+}
+
+int EventLoop::wait() {
+    struct epoll_event events[MAX_EVENTS];
+    for (int timer : expired) {
+        fired[timer] = false;
+    }
+    ready.clear();
+    expired.clear();
+    for (;;) {
+        int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        for (int i = 0; i != n; ++i) {
+            if (events[i].data.fd == timerfd) {
+                uint64_t expirations;
+                if (read(timerfd, &expirations, sizeof(expirations)) > 0) {
+                    armed_us = 0;
+                }
+            }
+            else {
+                ready.push_back(events[i].data.fd);
+            }
+        }
+        collect_expired();
+        if (!ready.empty() || !expired.empty()) {
+            return 0;
+        }
+    }
+}
+
+bool EventLoop::readable(int fd) const {
+    return std::find(ready.begin(), ready.end(), fd) != ready.end();
+}
+
+bool EventLoop::expired_timer(int timer) const {
+    return fired[timer];
+}
+
+// set the kernel timer to the next slot of the wheel
+void EventLoop::arm() {
+    struct itimerspec value;
+    memset(&value, 0, sizeof(value));
+    long next_us = wheel.next_deadline_us();
+    armed_us = 0;
+    if (next_us >= 0) {
+        // an absolute time of 0 would disarm the timer
+        armed_us = std::max(next_us, 1L);
+        value.it_value.tv_sec = armed_us / 1000000;
+        value.it_value.tv_nsec = armed_us % 1000000 * 1000;
+    }
+    if (timerfd_settime(timerfd, TFD_TIMER_ABSTIME, &value, NULL) != 0) {
+        print_sys_error("Unable to reset timer");
+        exit(EXIT_FAILURE);
+    }
+}
+
+void EventLoop::collect_expired() {
+    wheel.advance(now_us(), expired);
+    for (int timer : expired) {
+        fired[timer] = true;
+    }
+    // wait for the next slot, unless the kernel timer is already set before it
+    long next_us = wheel.next_deadline_us();
+    if (next_us >= 0 && (armed_us == 0 || armed_us > next_us)) {
+        arm();
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef _EVENT_LOOP_H_
+#define _EVENT_LOOP_H_
+
+#include "timer_wheel.h"
+
+#include <vector>
+#include <cstdint>
+
+// Readiness-based event loop: file descriptors are watched with epoll, timers live in user 
+// space (a hierarchical timing wheel) and share one timerfd, armed for the next slot of the 
+// wheel. Starting, restarting or stopping a timer is O(1) and usually costs no system call.
+//
+//     loop.wait();
+//     if (loop.readable(sockfd)) ...
+//     for (int timer : loop.expired_timers()) ...
+class EventLoop {
+public:
+    EventLoop();
+
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    // watch fd for input, -1 on error
+    int add(int fd);
+
+    void remove(int fd);
+
+    // one-shot timer, stopped until started
+    int create_timer();
+
+    void destroy_timer(int timer);
+
+    // (re)start the timer to expire delay_us from now
+    void start_timer(int timer, long delay_us);
+
+    void stop_timer(int timer);
+
+    bool timer_active(int timer) const { return wheel.active(timer); }
+
+    // block until a watched fd is readable or a timer expires, -1 on error
+    int wait();
+
+    // results of the last wait()
+    bool readable(int fd) const;
+
+    const std::vector<int>& expired_timers() const { return expired; }
+
+    // whether the timer is among expired_timers()
+    bool expired_timer(int timer) const;
+
+private:
+    int epfd;
+    int timerfd;
+    long armed_us; // deadline of timerfd, 0 if disarmed
+
+    TimerWheel wheel;
+    std::vector<char> fired; // timers in expired
+
+    std::vector<int> ready;
+    std::vector<int> expired;
+
+    void arm();
+
+    void collect_expired();
+};
+
+#endif
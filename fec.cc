@@ -0,0 +1,359 @@
+#include "fec.h"
+// C headers
+#include <cstring>
+#include <cmath>
+// C++ headers
+#include <algorithm>
+// x86 kernels are compiled for their instruction set and picked at run time
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FEC_X86_KERNELS
+#endif
+
+// GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d) and the generator 2
+struct GfTables {
+    uint8_t exp[512]; // doubled, so that exp[log a + log b] needs no modulo
+    uint8_t log[256];
+    uint8_t coefficients[FEC_MAX_PARITY][FEC_MAX_DATA];
+
+    GfTables();
+};
+
+GfTables::GfTables() {
+    int x = 1;
+    for (int i = 0; i != 255; ++i) {
+        exp[i] = x;
+        exp[i + 255] = x;
+        log[x] = i;
+        x <<= 1;
+        if (x & 0x100) {
+            x ^= 0x11d;
+        }
+    }
+    exp[510] = exp[0];
+    exp[511] = exp[1];
+    log[0] = 0;
+    // Cauchy matrix 1 / (x_j + y_i) with x_j = FEC_MAX_DATA + j and y_i = i, every square
+    // submatrix of which is invertible; dividing each column by its first entry keeps that
+    // and makes the first row all ones
+    for (int j = 0; j != FEC_MAX_PARITY; ++j) {
+        for (int i = 0; i != FEC_MAX_DATA; ++i) {
+            uint8_t first = FEC_MAX_DATA ^ i;
+            uint8_t own = (FEC_MAX_DATA + j) ^ i;
+            coefficients[j][i] = exp[log[first] + 255 - log[own]];
+        }
+    }
+}
+
+static const GfTables& tables() {
+    static const GfTables gf;
+    return gf;
+}
+
+uint8_t gf_mul(uint8_t a, uint8_t b) {
+    if (a == 0 || b == 0) {
+        return 0;
+    }
+    const GfTables& gf = tables();
+    return gf.exp[gf.log[a] + gf.log[b]];
+}
+
+static uint8_t gf_inverse(uint8_t a) {
+    const GfTables& gf = tables();
+    return gf.exp[255 - gf.log[a]];
+}
+
+uint8_t fec_coefficient(int parity, int data) {
+    return tables().coefficients[parity][data];
+}
+
+static void xor_scalar(const uint8_t* src, uint8_t* dst, size_t length) {
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t s, d;
+        memcpy(&s, src + i, 8);
+        memcpy(&d, dst + i, 8);
+        d ^= s;
+        memcpy(dst + i, &d, 8);
+    }
+    for (; i != length; ++i) {
+        dst[i] ^= src[i];
+    }
+}
+
+static void mul_add_scalar(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length) {
+    if (c == 1) {
+        xor_scalar(src, dst, length);
+        return;
+    }
+    // one row of the multiplication table
+    uint8_t row[256];
+    for (int x = 0; x != 256; ++x) {
+        row[x] = gf_mul(c, x);
+    }
+    for (size_t i = 0; i != length; ++i) {
+        dst[i] ^= row[src[i]];
+    }
+}
+
+#ifdef FEC_X86_KERNELS
+// c * x is c * (low nibble of x) + c * (high nibble of x), two lookups of 16 entries, which
+// is one byte shuffle each
+static void nibble_tables(uint8_t c, uint8_t* low, uint8_t* high) {
+    for (int x = 0; x != 16; ++x) {
+        low[x] = gf_mul(c, x);
+        high[x] = gf_mul(c, x << 4);
+    }
+}
+
+__attribute__((target("ssse3")))
+static void mul_add_ssse3(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length) {
+    size_t i = 0;
+    if (c == 1) {
+        for (; i + 16 <= length; i += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+            __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(d, s));
+        }
+    }
+    else {
+        uint8_t low[16], high[16];
+        nibble_tables(c, low, high);
+        __m128i low_table = _mm_loadu_si128((const __m128i*) low);
+        __m128i high_table = _mm_loadu_si128((const __m128i*) high);
+        __m128i mask = _mm_set1_epi8(0x0f);
+        for (; i + 16 <= length; i += 16) {
+            __m128i s = _mm_loadu_si128((const __m128i*) (src + i));
+            __m128i l = _mm_and_si128(s, mask);
+            __m128i h = _mm_and_si128(_mm_srli_epi64(s, 4), mask);
+            __m128i product = _mm_xor_si128(_mm_shuffle_epi8(low_table, l),
+                    _mm_shuffle_epi8(high_table, h));
+            __m128i d = _mm_loadu_si128((const __m128i*) (dst + i));
+            _mm_storeu_si128((__m128i*) (dst + i), _mm_xor_si128(d, product));
+        }
+    }
+    for (; i != length; ++i) {
+        dst[i] ^= gf_mul(c, src[i]);
+    }
+}
+
+__attribute__((target("avx2")))
+static void mul_add_avx2(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length) {
+    size_t i = 0;
+    if (c == 1) {
+        for (; i + 32 <= length; i += 32) {
+            __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+            __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(d, s));
+        }
+    }
+    else {
+        uint8_t low[16], high[16];
+        nibble_tables(c, low, high);
+        // the shuffle works within each 128-bit lane, both lanes get the tables
+        __m256i low_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) low));
+        __m256i high_table = _mm256_broadcastsi128_si256(
+                _mm_loadu_si128((const __m128i*) high));
+        __m256i mask = _mm256_set1_epi8(0x0f);
+        for (; i + 32 <= length; i += 32) {
+            __m256i s = _mm256_loadu_si256((const __m256i*) (src + i));
+            __m256i l = _mm256_and_si256(s, mask);
+            __m256i h = _mm256_and_si256(_mm256_srli_epi64(s, 4), mask);
+            __m256i product = _mm256_xor_si256(_mm256_shuffle_epi8(low_table, l),
+                    _mm256_shuffle_epi8(high_table, h));
+            __m256i d = _mm256_loadu_si256((const __m256i*) (dst + i));
+            _mm256_storeu_si256((__m256i*) (dst + i), _mm256_xor_si256(d, product));
+        }
+    }
+    for (; i != length; ++i) {
+        dst[i] ^= gf_mul(c, src[i]);
+    }
+}
+
+static bool has_ssse3() {
+    return __builtin_cpu_supports("ssse3");
+}
+
+static bool has_avx2() {
+    return __builtin_cpu_supports("avx2");
+}
+#endif
+
+static bool has_scalar() {
+    return true;
+}
+
+struct GfKernel {
+    const char* name;
+    void (*mul_add)(uint8_t c, const uint8_t* src, uint8_t* dst, size_t length);
+    bool (*supported)();
+};
+
+// fastest first
+static const GfKernel KERNELS[] = {
+#ifdef FEC_X86_KERNELS
+    {"avx2", mul_add_avx2, has_avx2},
+    {"ssse3", mul_add_ssse3, has_ssse3},
+#endif
+    {"scalar", mul_add_scalar, has_scalar}
+};
+
+static const GfKernel* best_kernel() {
+    for (const GfKernel& kernel : KERNELS) {
+        if (kernel.supported()) {
+            return &kernel;
+        }
+    }
+    return NULL;
+}
+
+// picked once, on first use
+static const GfKernel*& active_kernel() {
+    static const GfKernel* kernel = best_kernel();
+    return kernel;
+}
+
+void gf_mul_add(uint8_t c, const char* src, char* dst, size_t length) {
+    if (c != 0) {
+        active_kernel()->mul_add(c, (const uint8_t*) src, (uint8_t*) dst, length);
+    }
+}
+
+const char* gf_kernel() {
+    return active_kernel()->name;
+}
+
+bool gf_use_kernel(const std::string& name) {
+    for (const GfKernel& kernel : KERNELS) {
+        if (name == kernel.name && kernel.supported()) {
+            active_kernel() = &kernel;
+            return true;
+        }
+    }
+    return false;
+}
+
+// blocks are not worth protecting below this loss rate
+static const double FEC_MIN_LOSS_RATE = 0.001;
+
+// probability that more than m of n packets are lost
+static double loss_tail(int n, int m, double p) {
+    double term = std::pow(1 - p, n);
+    double cdf = term;
+    for (int i = 1; i <= m; ++i) {
+        term *= (double) (n - i + 1) / i * p / (1 - p);
+        cdf += term;
+    }
+    return 1 - cdf;
+}
+
+int fec_parity_count(int k, double loss_rate) {
+    if (loss_rate < FEC_MIN_LOSS_RATE) {
+        return 0;
+    }
+    double p = std::min(loss_rate, 0.5);
+    // without parity a block needs retransmissions if any data packet is lost
+    double target = (1 - std::pow(1 - p, k)) / 10;
+    for (int m = 1; m < FEC_MAX_PARITY; ++m) {
+        if (loss_tail(k + m, m, p) <= target) {
+            return m;
+        }
+    }
+    return FEC_MAX_PARITY;
+}
+
+FecEncoder::FecEncoder(int max_segment) : k(0), m(0), size(max_segment), added(0),
+    parities((size_t) FEC_MAX_PARITY * max_segment) {
+}
+
+void FecEncoder::start(int k, int m, int segment) {
+    this->k = k;
+    this->m = m;
+    size = segment;
+    added = 0;
+    memset(parities.data(), 0, (size_t) m * segment);
+}
+
+bool FecEncoder::add(const char* payload, int length) {
+    for (int j = 0; j != m; ++j) {
+        gf_mul_add(fec_coefficient(j, added), payload, parities.data() + (size_t) j * size,
+                length);
+    }
+    ++added;
+    return added == k;
+}
+
+// invert the n x n matrix a in place (Gauss-Jordan), it is known to be invertible
+static void invert(uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY], int n) {
+    uint8_t inverse[FEC_MAX_PARITY][FEC_MAX_PARITY] = {};
+    for (int i = 0; i != n; ++i) {
+        inverse[i][i] = 1;
+    }
+    for (int col = 0; col != n; ++col) {
+        int pivot = col;
+        while (a[pivot][col] == 0) {
+            ++pivot;
+        }
+        for (int c = 0; c != n; ++c) {
+            std::swap(a[col][c], a[pivot][c]);
+            std::swap(inverse[col][c], inverse[pivot][c]);
+        }
+        uint8_t scale = gf_inverse(a[col][col]);
+        for (int c = 0; c != n; ++c) {
+            a[col][c] = gf_mul(a[col][c], scale);
+            inverse[col][c] = gf_mul(inverse[col][c], scale);
+        }
+        for (int row = 0; row != n; ++row) {
+            uint8_t factor = a[row][col];
+            if (row == col || factor == 0) {
+                continue;
+            }
+            for (int c = 0; c != n; ++c) {
+                a[row][c] ^= gf_mul(factor, a[col][c]);
+                inverse[row][c] ^= gf_mul(factor, inverse[col][c]);
+            }
+        }
+    }
+    memcpy(a, inverse, sizeof(inverse));
+}
+
+bool fec_decode(int k, int segment, const char* const* data, int parity_count,
+        const uint8_t* parity_index, const char* const* parity, char* const* recovered) {
+    int missing[FEC_MAX_PARITY];
+    int count = 0;
+    for (int i = 0; i != k; ++i) {
+        if (data[i] == NULL) {
+            if (count == parity_count || count == FEC_MAX_PARITY) {
+                return false;
+            }
+            missing[count++] = i;
+        }
+    }
+    if (count == 0) {
+        return true;
+    }
+    // the first `count` parity packets without the received data packets leave
+    // a * missing = syndromes
+    std::vector<char> syndromes((size_t) count * segment);
+    uint8_t a[FEC_MAX_PARITY][FEC_MAX_PARITY];
+    for (int r = 0; r != count; ++r) {
+        char* syndrome = syndromes.data() + (size_t) r * segment;
+        memcpy(syndrome, parity[r], segment);
+        for (int i = 0; i != k; ++i) {
+            if (data[i] != NULL) {
+                gf_mul_add(fec_coefficient(parity_index[r], i), data[i], syndrome, segment);
+            }
+        }
+        for (int t = 0; t != count; ++t) {
+            a[r][t] = fec_coefficient(parity_index[r], missing[t]);
+        }
+    }
+    invert(a, count);
+    for (int t = 0; t != count; ++t) {
+        memset(recovered[t], 0, segment);
+        for (int r = 0; r != count; ++r) {
+            gf_mul_add(a[t][r], syndromes.data() + (size_t) r * segment, recovered[t], segment);
+        }
+    }
+    return true;
+}
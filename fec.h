@@ -0,0 +1,67 @@
+#ifndef _FEC_H_
+#define _FEC_H_
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Forward error correction over blocks of data packets: k data packets of a full segment are
+// followed by m parity packets of the same size, and any k of the k + m packets rebuild the
+// block. The code is a systematic Reed-Solomon code over GF(2^8) with a Cauchy matrix, whose
+// columns are scaled so that the first parity packet is the XOR of the data packets.
+const int FEC_MAX_DATA = 64;   // data packets of a block
+const int FEC_MAX_PARITY = 8;  // parity packets of a block
+
+// dst ^= c * src over GF(2^8), with the fastest kernel of the CPU (AVX2, SSSE3 or a table)
+void gf_mul_add(uint8_t c, const char* src, char* dst, size_t length);
+
+uint8_t gf_mul(uint8_t a, uint8_t b);
+
+// name of the kernel of gf_mul_add()
+const char* gf_kernel();
+
+// use a given kernel ("avx2", "ssse3" or "scalar"), false if the CPU lacks it; not thread
+// safe, for benchmarks
+bool gf_use_kernel(const std::string& name);
+
+// coefficient of the data packet `data` in the parity packet `parity`, 1 for parity 0
+uint8_t fec_coefficient(int parity, int data);
+
+// parity packets for blocks of k data packets at the given loss rate (losses per packet),
+// so that a block needs retransmissions at most a tenth as often as without parity
+int fec_parity_count(int k, double loss_rate);
+
+// Parity of one block, accumulated as its data packets are sent
+class FecEncoder {
+public:
+    explicit FecEncoder(int max_segment);
+
+    // a new block of k data packets of `segment` bytes protected by m parity packets
+    void start(int k, int m, int segment);
+
+    // add the next data packet of the block, returns true once the block is complete
+    bool add(const char* payload, int length);
+
+    int data_packets() const { return k; }
+
+    int parity_packets() const { return m; }
+
+    const char* parity(int j) const { return parities.data() + (size_t) j * size; }
+
+private:
+    int k;
+    int m;
+    int size;
+    int added;
+    std::vector<char> parities;
+};
+
+// Rebuild the missing data packets of a block of k: data[i] is the payload of data packet i
+// (`segment` bytes), NULL if missing, parity[j] the payload of the parity packet of index
+// parity_index[j]. The missing packets are written to `recovered` in order of their index.
+// Returns false if fewer parity packets than missing data packets were received.
+bool fec_decode(int k, int segment, const char* const* data, int parity_count,
+        const uint8_t* parity_index, const char* const* parity, char* const* recovered);
+
+#endif
@@ -0,0 +1,85 @@
+#include "file_reader.h"
+#include "utils.h"
+// C headers
+#include <cstring>
+// LINUX headers
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+FileReader::FileReader() : fd(-1), length(0), mapping(NULL), chunk_offset(0), chunk_length(0) {
+}
+
+FileReader::~FileReader() {
+    close();
+}
+
+int FileReader::open(const std::string& file_path, FileReadMode mode, size_t chunk_size) {
+    close();
+    fd = ::open(file_path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        print_sys_error("Unable to stat file");
+        close();
+        return -1;
+    }
+    length = st.st_size;
+    if (mode == READ_MMAP && length != 0) {
+        void* addr = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr != MAP_FAILED) {
+            mapping = (const char*) addr;
+            // pages are touched once, in order
+            madvise(addr, length, MADV_SEQUENTIAL);
+            return 0;
+        }
+        print_sys_error("Unable to map file, reading in chunks");
+    }
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    chunk.resize(chunk_size);
+    chunk_offset = 0;
+    chunk_length = 0;
+    return 0;
+}
+
+void FileReader::close() {
+    if (mapping != NULL) {
+        munmap(const_cast<char*>(mapping), length);
+        mapping = NULL;
+    }
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+    length = 0;
+    chunk_length = 0;
+}
+
+int FileReader::read(size_t offset, char* buffer, size_t bytes) {
+    if (offset + bytes > length) {
+        return -1;
+    }
+    if (mapping != NULL) {
+        memcpy(buffer, mapping + offset, bytes);
+        return 0;
+    }
+    if (bytes > chunk.size()) {
+        // larger than a chunk, read directly
+        return pread(fd, buffer, bytes, offset) == (ssize_t) bytes ? 0 : -1;
+    }
+    if (offset < chunk_offset || offset + bytes > chunk_offset + chunk_length) {
+        // refill the chunk starting from offset (retransmissions move it backwards)
+        ssize_t n = pread(fd, chunk.data(), chunk.size(), offset);
+        if (n < (ssize_t) bytes) {
+            chunk_length = 0;
+            return -1;
+        }
+        chunk_offset = offset;
+        chunk_length = n;
+    }
+    memcpy(buffer, chunk.data() + (offset - chunk_offset), bytes);
+    return 0;
+}
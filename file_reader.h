@@ -0,0 +1,44 @@
+#ifndef _FILE_READER_H_
+#define _FILE_READER_H_
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+enum FileReadMode {
+    READ_MMAP,  // map the whole file, fall back to READ_CHUNK if mapping fails
+    READ_CHUNK  // pread the file in fixed-size chunks
+};
+
+// Random access to the file being sent, so packets can be built on demand from an offset
+// instead of copying the whole file into memory first.
+class FileReader {
+public:
+    FileReader();
+
+    ~FileReader();
+
+    FileReader(const FileReader&) = delete;
+
+    FileReader& operator=(const FileReader&) = delete;
+
+    int open(const std::string& file_path, FileReadMode mode, size_t chunk_size);
+
+    void close();
+
+    size_t size() const { return length; }
+
+    // copy `bytes` bytes starting at `offset` to `buffer`, returns -1 on error
+    int read(size_t offset, char* buffer, size_t bytes);
+
+private:
+    int fd;
+    size_t length;
+    const char* mapping; // NULL when reading in chunks
+
+    std::vector<char> chunk; // cached chunk
+    size_t chunk_offset;     // file offset of the cached chunk
+    size_t chunk_length;     // valid bytes in the cached chunk
+};
+
+#endif
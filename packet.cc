@@ -0,0 +1,207 @@
+#include "packet.h"
+// C headers
+#include <cstring>
+// C++ headers
+#include <algorithm>
+
+Header ConstHeaderView::header() const {
+    Header header;
+    header.seq_number = seq_number();
+    header.ack_number = ack_number();
+    header.ack = ack();
+    header.syn = syn();
+    header.fin = fin();
+    header.version = version();
+    return header;
+}
+
+void encode_header(const Header& header, char* packet) {
+    HeaderView view(packet);
+    if (header.syn) {
+        view.reset_handshake(header.version);
+    }
+    else {
+        view.reset(header.version);
+    }
+    view.set_seq_number(header.seq_number);
+    view.set_ack_number(header.ack_number);
+    view.set_ack(header.ack);
+    view.set_syn(header.syn);
+    view.set_fin(header.fin);
+}
+
+void decode_header(const char* packet, Header& header) {
+    header = ConstHeaderView(packet).header();
+}
+
+// 16-bit option, left out if 0
+static int encode_u16_option(uint8_t kind, uint16_t value, char* payload) {
+    if (value == 0) {
+        return 0;
+    }
+    payload[0] = kind;
+    payload[1] = 2;
+    payload[2] = value >> 8;
+    payload[3] = value & 0xff;
+    return 4;
+}
+
+int encode_syn_options(const SynOptions& options, char* payload) {
+    int length = 0;
+    if (options.window != 0) {
+        // smallest shift which fits the window in 16 bits, like TCP window scaling
+        uint8_t shift = 0;
+        while ((options.window >> shift) > 0xffff) {
+            ++shift;
+        }
+        uint16_t value = options.window >> shift;
+        payload[length++] = OPTION_WINDOW;
+        payload[length++] = 3;
+        payload[length++] = value >> 8;
+        payload[length++] = value & 0xff;
+        payload[length++] = shift;
+    }
+    if (options.sack) {
+        payload[length++] = OPTION_SACK;
+        payload[length++] = 0;
+    }
+    length += encode_u16_option(OPTION_MSS, options.mss, payload + length);
+    length += encode_u16_option(OPTION_PROBE, options.probe, payload + length);
+    length += encode_u16_option(OPTION_SEGMENT, options.segment, payload + length);
+    if (options.fec) {
+        payload[length++] = OPTION_FEC;
+        payload[length++] = 0;
+    }
+    if (options.checksum) {
+        payload[length++] = OPTION_CHECKSUM;
+        payload[length++] = 0;
+    }
+    payload[length++] = OPTION_END;
+    return length;
+}
+
+void decode_syn_options(const char* payload, int length, SynOptions& options) {
+    options = SynOptions();
+    int i = 0;
+    while (i + 1 < length && payload[i] != OPTION_END) {
+        uint8_t kind = payload[i];
+        uint8_t size = payload[i + 1];
+        const uint8_t* value = (const uint8_t*) payload + i + 2;
+        if (i + 2 + size > length) {
+            break;
+        }
+        if (kind == OPTION_WINDOW && size == 3 && value[2] < 32) {
+            options.window = (uint32_t) (value[0] << 8 | value[1]) << value[2];
+        }
+        else if (kind == OPTION_SACK) {
+            options.sack = true;
+        }
+        else if (kind == OPTION_FEC) {
+            options.fec = true;
+        }
+        else if (kind == OPTION_CHECKSUM) {
+            options.checksum = true;
+        }
+        else if (size == 2 && (kind == OPTION_MSS || kind == OPTION_PROBE 
+                    || kind == OPTION_SEGMENT)) {
+            uint16_t number = value[0] << 8 | value[1];
+            uint16_t& field = kind == OPTION_MSS ? options.mss 
+                : kind == OPTION_PROBE ? options.probe : options.segment;
+            field = number;
+        }
+        i += 2 + size;
+    }
+}
+
+static void write_u32(uint32_t value, char* p) {
+    p[0] = value >> 24;
+    p[1] = value >> 16;
+    p[2] = value >> 8;
+    p[3] = value;
+}
+
+static uint32_t read_u32(const char* p) {
+    const uint8_t* u = (const uint8_t*) p;
+    return (uint32_t) u[0] << 24 | u[1] << 16 | u[2] << 8 | u[3];
+}
+
+int encode_sack_blocks(const SackBlock* blocks, int count, char* payload) {
+    count = std::min(count, MAX_SACK_BLOCKS);
+    payload[0] = count;
+    for (int i = 0; i != count; ++i) {
+        write_u32(blocks[i].start, payload + 1 + 8 * i);
+        write_u32(blocks[i].end, payload + 5 + 8 * i);
+    }
+    return 1 + 8 * count;
+}
+
+int decode_sack_blocks(const char* payload, int length, SackBlock* blocks) {
+    if (length < 1) {
+        return 0;
+    }
+    int count = (uint8_t) payload[0];
+    count = std::min(std::min(count, MAX_SACK_BLOCKS), (length - 1) / 8);
+    for (int i = 0; i != count; ++i) {
+        blocks[i].start = read_u32(payload + 1 + 8 * i);
+        blocks[i].end = read_u32(payload + 5 + 8 * i);
+    }
+    return count;
+}
+
+int encode_header_options(const HeaderOptions& options, char* buffer) {
+    int length = 0;
+    if (options.fec) {
+        buffer[length++] = HEADER_OPTION_FEC;
+        buffer[length++] = 2;
+        buffer[length++] = options.fec_block;
+        buffer[length++] = options.fec_position;
+    }
+    if (options.recovered != 0) {
+        buffer[length++] = HEADER_OPTION_RECOVERED;
+        buffer[length++] = 4;
+        write_u32(options.recovered, buffer + length);
+        length += 4;
+    }
+    if (options.has_digest) {
+        buffer[length++] = HEADER_OPTION_DIGEST;
+        buffer[length++] = 4;
+        write_u32(options.digest, buffer + length);
+        length += 4;
+    }
+    if (options.checksum) {
+        buffer[length++] = HEADER_OPTION_CHECKSUM;
+        buffer[length++] = 4;
+        memset(buffer + length, 0, 4);
+        length += 4;
+    }
+    return length;
+}
+
+void decode_header_options(const char* buffer, int length, HeaderOptions& options) {
+    options = HeaderOptions();
+    int i = 0;
+    while (i + 1 < length && buffer[i] != HEADER_OPTION_END) {
+        uint8_t kind = buffer[i];
+        uint8_t size = buffer[i + 1];
+        const char* value = buffer + i + 2;
+        if (i + 2 + size > length) {
+            break;
+        }
+        if (kind == HEADER_OPTION_FEC && size == 2) {
+            options.fec = true;
+            options.fec_block = value[0];
+            options.fec_position = value[1];
+        }
+        else if (kind == HEADER_OPTION_RECOVERED && size == 4) {
+            options.recovered = read_u32(value);
+        }
+        else if (kind == HEADER_OPTION_DIGEST && size == 4) {
+            options.has_digest = true;
+            options.digest = read_u32(value);
+        }
+        else if (kind == HEADER_OPTION_CHECKSUM && size == 4) {
+            options.checksum = true;
+        }
+        i += 2 + size;
+    }
+}
@@ -2,20 +2,348 @@
 #define _PACKET_H_
 
 #include <cstdio>
-#include <vector>
-#include <list>
+#include <cstdint>
+#include <cstring>
+
+// wire format versions, carried in byte 7 of the 12-byte header and in the high nibble of 
+// byte 4 of the packed header
+enum HeaderVersion {
+    LEGACY_VERSION = 0, // 16-bit sequence numbers modulo max_seq_number (25600)
+    SEQ32_VERSION = 1,  // 32-bit sequence numbers, negotiated with SYN / SYN-ACK
+    PACKED_VERSION = 2  // SEQ32_VERSION with the packed header after hand-shaking
+};
+
+// sequence space of SEQ32_VERSION and later connections
+const uint64_t SEQ32_SPACE = (uint64_t) 1 << 32;
+
+// The 12-byte header, used by legacy and SEQ32 connections and by SYN / SYN-ACK of all 
+// versions, so that peers of any version can read them:
+//   0-1   low 16 bits of seq_number
+//   2-3   low 16 bits of ack_number
+//   4-6   ack, syn, fin flags, one byte each (0 or 1)
+//   7     version (the highest one supported in SYN, the chosen one in SYN-ACK)
+//   8-9   high 16 bits of seq_number (0 in LEGACY_VERSION)
+//   10-11 high 16 bits of ack_number (0 in LEGACY_VERSION)
+// which is the original layout with the version and high bits in the former padding. The 
+// 16-bit fields are little-endian on every host, the byte order the original x86 peers 
+// wrote in host order.
+const int HEADER_SIZE = 12;
+const int SEQ_LOW_OFFSET = 0;
+const int ACK_LOW_OFFSET = 2;
+const int FLAGS_OFFSET = 4;
+const int VERSION_OFFSET = 7;
+const int SEQ_HIGH_OFFSET = 8;
+const int ACK_HIGH_OFFSET = 10;
+
+static_assert(SEQ_LOW_OFFSET + 2 == ACK_LOW_OFFSET && ACK_LOW_OFFSET + 2 == FLAGS_OFFSET
+        && FLAGS_OFFSET + 3 == VERSION_OFFSET && VERSION_OFFSET + 1 == SEQ_HIGH_OFFSET
+        && SEQ_HIGH_OFFSET + 2 == ACK_HIGH_OFFSET && ACK_HIGH_OFFSET + 2 == HEADER_SIZE,
+        "12-byte header fields must be contiguous");
+
+// The packed header of PACKED_VERSION connections, fixed-width fields in network order:
+//   0-3   seq_number
+//   4     version (high 4 bits), flags (low 4 bits)
+//   5     length of the options between the header and the payload
+//   6-9   ack_number
+// Byte 4 of the 12-byte header is the ack flag (0 or 1) while a packed header has a nonzero
+// version there, so the layout of any packet is known from the packet itself.
+const int PACKED_HEADER_SIZE = 10;
+const int PACKED_SEQ_OFFSET = 0;
+const int PACKED_TYPE_OFFSET = 4;
+const int PACKED_OPTIONS_OFFSET = 5;
+const int PACKED_ACK_OFFSET = 6;
+
+static_assert(PACKED_SEQ_OFFSET + 4 == PACKED_TYPE_OFFSET 
+        && PACKED_TYPE_OFFSET + 1 == PACKED_OPTIONS_OFFSET
+        && PACKED_OPTIONS_OFFSET + 1 == PACKED_ACK_OFFSET
+        && PACKED_ACK_OFFSET + 4 == PACKED_HEADER_SIZE, "packed header fields must be contiguous");
+static_assert(PACKED_TYPE_OFFSET == FLAGS_OFFSET, 
+        "the version of the packed header must overlap the ack flag of the 12-byte header");
+static_assert(PACKED_VERSION < 16, "the version of the packed header has 4 bits");
+
+// flags of the packed header
+const uint8_t FLAG_ACK = 1;
+const uint8_t FLAG_SYN = 2;
+const uint8_t FLAG_FIN = 4;
+
+// header size of the packets of a connection after hand-shaking (options excluded)
+inline int header_size(uint8_t version) {
+    return version >= PACKED_VERSION ? PACKED_HEADER_SIZE : HEADER_SIZE;
+}
 
 struct Header {
-    unsigned short seq_number; // 2
-    unsigned short ack_number; // 2
-    bool ack;                  // 1
-    bool syn;                  // 1
-    bool fin;                  // 1
-    char padding[5];           // 1
-}; // total: 12 bytes
-
-typedef std::pair<Header, std::vector<char> > DataPacket;
-typedef std::list<DataPacket> Buffer;
-typedef Buffer::iterator BuffIter;
+    uint32_t seq_number;
+    uint32_t ack_number;
+    bool ack;
+    bool syn;
+    bool fin;
+    uint8_t version;
+};
+
+// Header fields read in place from a packet buffer, in either layout
+class ConstHeaderView {
+public:
+    explicit ConstHeaderView(const char* packet) : packet(packet) {}
+
+    bool packed() const { return byte(PACKED_TYPE_OFFSET) >> 4 != 0; }
+
+    uint32_t seq_number() const { 
+        return packed() ? read_be32(PACKED_SEQ_OFFSET) : field(SEQ_LOW_OFFSET, SEQ_HIGH_OFFSET);
+    }
+
+    uint32_t ack_number() const { 
+        return packed() ? read_be32(PACKED_ACK_OFFSET) : field(ACK_LOW_OFFSET, ACK_HIGH_OFFSET);
+    }
+
+    bool ack() const { return flag(FLAG_ACK, 0); }
+
+    bool syn() const { return flag(FLAG_SYN, 1); }
+
+    bool fin() const { return flag(FLAG_FIN, 2); }
+
+    uint8_t version() const { 
+        return packed() ? byte(PACKED_TYPE_OFFSET) >> 4 : byte(VERSION_OFFSET);
+    }
+
+    // header size including options
+    int size() const { 
+        return packed() ? PACKED_HEADER_SIZE + byte(PACKED_OPTIONS_OFFSET) : HEADER_SIZE;
+    }
+
+    // options of the packed header (see HeaderOptions), the 12-byte header has none
+    int options_length() const { return packed() ? byte(PACKED_OPTIONS_OFFSET) : 0; }
+
+    const char* options() const { return packet + PACKED_HEADER_SIZE; }
+
+    const char* payload() const { return packet + size(); }
+
+    // copy of all fields, e.g. for logging
+    Header header() const;
+
+protected:
+    const char* packet;
+
+    uint8_t byte(int offset) const { return (uint8_t) packet[offset]; }
+
+    bool flag(uint8_t packed_flag, int legacy_byte) const {
+        return packed() ? (byte(PACKED_TYPE_OFFSET) & packed_flag) != 0 
+            : byte(FLAGS_OFFSET + legacy_byte) != 0;
+    }
+
+    uint32_t read_be32(int offset) const {
+        return (uint32_t) byte(offset) << 24 | byte(offset + 1) << 16 | byte(offset + 2) << 8 
+            | byte(offset + 3);
+    }
+
+    uint16_t read_le16(int offset) const {
+        return byte(offset) | byte(offset + 1) << 8;
+    }
+
+    uint32_t field(int low, int high) const {
+        uint16_t low_bits = read_le16(low);
+        uint16_t high_bits = read_le16(high);
+        // the padding of legacy packets carries no high bits
+        if (byte(VERSION_OFFSET) == LEGACY_VERSION) {
+            high_bits = 0;
+        }
+        return (uint32_t) high_bits << 16 | low_bits;
+    }
+};
+
+// Header fields written in place into a packet buffer
+class HeaderView : public ConstHeaderView {
+public:
+    explicit HeaderView(char* packet) : ConstHeaderView(packet) {}
+
+    // clear all fields and flags, the layout follows the version
+    void reset(uint8_t version) {
+        if (version >= PACKED_VERSION) {
+            memset(buffer(), 0, PACKED_HEADER_SIZE);
+            buffer()[PACKED_TYPE_OFFSET] = version << 4;
+        }
+        else {
+            reset_handshake(version);
+        }
+    }
+
+    // SYN and SYN-ACK use the 12-byte header whatever the version
+    void reset_handshake(uint8_t version) {
+        memset(buffer(), 0, HEADER_SIZE);
+        buffer()[VERSION_OFFSET] = version;
+    }
+
+    void set_seq_number(uint32_t seq_number) { 
+        if (packed()) {
+            write_be32(PACKED_SEQ_OFFSET, seq_number);
+        }
+        else {
+            set_field(SEQ_LOW_OFFSET, SEQ_HIGH_OFFSET, seq_number);
+        }
+    }
+
+    void set_ack_number(uint32_t ack_number) { 
+        if (packed()) {
+            write_be32(PACKED_ACK_OFFSET, ack_number);
+        }
+        else {
+            set_field(ACK_LOW_OFFSET, ACK_HIGH_OFFSET, ack_number);
+        }
+    }
+
+    void set_ack(bool ack) { set_flag(FLAG_ACK, 0, ack); }
+
+    void set_syn(bool syn) { set_flag(FLAG_SYN, 1, syn); }
+
+    void set_fin(bool fin) { set_flag(FLAG_FIN, 2, fin); }
+
+    // room for the options of a packed header, set before writing options() and payload()
+    void set_options_length(int length) { buffer()[PACKED_OPTIONS_OFFSET] = length; }
+
+    char* options() { return buffer() + PACKED_HEADER_SIZE; }
+
+    char* payload() { return buffer() + size(); }
+
+private:
+    char* buffer() { return const_cast<char*>(packet); }
+
+    void set_flag(uint8_t packed_flag, int legacy_byte, bool value) {
+        if (packed()) {
+            uint8_t type = byte(PACKED_TYPE_OFFSET);
+            buffer()[PACKED_TYPE_OFFSET] = value ? type | packed_flag : type & ~packed_flag;
+        }
+        else {
+            buffer()[FLAGS_OFFSET + legacy_byte] = value;
+        }
+    }
+
+    void write_be32(int offset, uint32_t value) {
+        buffer()[offset] = value >> 24;
+        buffer()[offset + 1] = value >> 16;
+        buffer()[offset + 2] = value >> 8;
+        buffer()[offset + 3] = value;
+    }
+
+    void write_le16(int offset, uint16_t value) {
+        buffer()[offset] = value;
+        buffer()[offset + 1] = value >> 8;
+    }
+
+    void set_field(int low, int high, uint32_t value) {
+        write_le16(low, value & 0xffff);
+        write_le16(high, value >> 16);
+    }
+};
+
+// true if the packet holds a whole header of either layout, options included
+inline bool header_complete(const char* packet, int length) {
+    return length >= PACKED_HEADER_SIZE && length >= ConstHeaderView(packet).size();
+}
+
+void encode_header(const Header& header, char* packet);
+
+void decode_header(const char* packet, Header& header);
+
+// payload of full data packets unless the connection negotiates a segment size, a packet of 
+// this size fits the smallest IPv4 MTU (576)
+const int BASE_SEGMENT_SIZE = 512;
+
+// IPv4 and UDP headers, between the path MTU and our packets
+const int UDP_IP_OVERHEAD = 28;
+
+// Options of SYN and SYN-ACK packets, carried in their payload as a list of 
+// <kind, length, value> entries. Unknown entries are skipped, and so is the zero padding of
+// probes after OPTION_END.
+enum OptionKind {
+    OPTION_END = 0,
+    OPTION_WINDOW = 1,  // receive window: 16-bit value, 8-bit shift (bytes = value << shift)
+    OPTION_SACK = 2,    // selective acknowledgements are understood, no value
+    OPTION_MSS = 3,     // 16-bit largest segment: the client's in SYN, both ends' in SYN-ACK
+    OPTION_PROBE = 4,   // 16-bit segment of a path MTU probe: SYN padded to the size of a data
+                        // packet of that segment, echoed by SYN-ACK if it arrived
+    OPTION_SEGMENT = 5, // 16-bit segment of the data packets: chosen by the client in SYN, 
+                        // the one in use in SYN-ACK
+    OPTION_FEC = 6,     // forward error correction (PACKED_VERSION only), no value: offered 
+                        // in SYN, accepted in SYN-ACK
+    OPTION_CHECKSUM = 7 // checksums (PACKED_VERSION only), no value: offered in SYN, accepted
+                        // in SYN-ACK, then every packet but SYN carries HEADER_OPTION_CHECKSUM
+                        // and FIN / FIN-ACK the digest of the file
+};
+
+struct SynOptions {
+    uint32_t window; // receive window in bytes, 0 if not advertised
+    bool sack;       // ACK packets may carry SACK blocks
+    uint16_t mss;     // 0 if not advertised
+    uint16_t probe;   // 0 if not a probe
+    uint16_t segment; // 0 if not advertised
+    bool fec;         // forward error correction, see HeaderOptions
+    bool checksum;    // CRC32C of the packets and of the file, see HeaderOptions
+
+    SynOptions() : window(0), sack(false), mss(0), probe(0), segment(0), fec(false), 
+        checksum(false) {}
+};
+
+// returns the number of bytes written
+int encode_syn_options(const SynOptions& options, char* payload);
+
+void decode_syn_options(const char* payload, int length, SynOptions& options);
+
+// Range [start, end) of sequence numbers received above the cumulative ACK number. ACK 
+// packets of connections which negotiated OPTION_SACK carry a block count (1 byte) followed 
+// by the blocks (32-bit start and end) in their payload, lowest sequence numbers first.
+struct SackBlock {
+    uint32_t start;
+    uint32_t end;
+};
+
+const int MAX_SACK_BLOCKS = 32;
+
+// returns the number of bytes written
+int encode_sack_blocks(const SackBlock* blocks, int count, char* payload);
+
+// returns the number of blocks read, at most MAX_SACK_BLOCKS
+int decode_sack_blocks(const char* payload, int length, SackBlock* blocks);
+
+// Options of the packed header, between the header and the payload, as <kind, length, value>
+// entries like the options of SYN packets.
+enum HeaderOptionKind {
+    HEADER_OPTION_END = 0,
+    HEADER_OPTION_FEC = 1,       // FEC payload id of the packets of connections which 
+                                 // negotiated OPTION_FEC: data packets of the block (0 if the 
+                                 // packet is not protected) and position in the block (data 
+                                 // packets 0 to k - 1, then the parity packets), 1 byte each
+    HEADER_OPTION_RECOVERED = 2, // 32-bit count of data packets rebuilt from parity packets, 
+                                 // in ACK packets
+    HEADER_OPTION_DIGEST = 3,    // 32-bit CRC32C of the file: of the data sent in FIN, of the
+                                 // data written in FIN-ACK
+    HEADER_OPTION_CHECKSUM = 4   // 32-bit CRC32C of the packet (see write_packet_checksum()), 
+                                 // always the last option
+};
+
+// every packet of a FEC connection carries it, so data and parity packets have the same size
+const int FEC_OPTION_SIZE = 4;
+
+const int CHECKSUM_OPTION_SIZE = 6;
+
+// A parity packet carries the sequence number of the first data packet of its block, whose 
+// data packets are consecutive full segments.
+struct HeaderOptions {
+    bool fec;             // the packet carries a FEC payload id
+    uint8_t fec_block;    // data packets of the block
+    uint8_t fec_position;
+    uint32_t recovered;   // 0 if not advertised
+    bool has_digest;
+    uint32_t digest;      // of the file, FIN and FIN-ACK only
+    bool checksum;        // room for the checksum, written once the packet is complete
+
+    HeaderOptions() : fec(false), fec_block(0), fec_position(0), recovered(0), 
+        has_digest(false), digest(0), checksum(false) {}
+
+    bool parity() const { return fec && fec_block != 0 && fec_position >= fec_block; }
+};
+
+// returns the number of bytes written
+int encode_header_options(const HeaderOptions& options, char* buffer);
+
+void decode_header_options(const char* buffer, int length, HeaderOptions& options);
 
 #endif
@@ -0,0 +1,28 @@
+#include "packet_pool.h"
+
+PacketPool::PacketPool(int buffer_size, int buffers_per_slab) : size(buffer_size), 
+    per_slab(buffers_per_slab) {
+    grow();
+}
+
+void PacketPool::grow() {
+    slabs.emplace_back(new char[(size_t) size * per_slab]);
+    char* slab = slabs.back().get();
+    free_buffers.reserve(slabs.size() * per_slab);
+    for (int i = per_slab - 1; i >= 0; --i) {
+        free_buffers.push_back(slab + (size_t) i * size);
+    }
+}
+
+char* PacketPool::acquire() {
+    if (free_buffers.empty()) {
+        grow();
+    }
+    char* buffer = free_buffers.back();
+    free_buffers.pop_back();
+    return buffer;
+}
+
+void PacketPool::release(char* buffer) {
+    free_buffers.push_back(buffer);
+}
@@ -0,0 +1,33 @@
+#ifndef _PACKET_POOL_H_
+#define _PACKET_POOL_H_
+
+#include <vector>
+#include <memory>
+
+// Fixed-size packet buffers carved from slabs. acquire() and release() only move a pointer on
+// the free list, a new slab is allocated when the pool runs dry, so once the pool has grown
+// to the peak number of buffers in use no packet allocates memory.
+class PacketPool {
+public:
+    PacketPool(int buffer_size, int buffers_per_slab);
+
+    PacketPool(const PacketPool&) = delete;
+
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    char* acquire();
+
+    void release(char* buffer);
+
+    int buffer_size() const { return size; }
+
+private:
+    int size;
+    int per_slab;
+    std::vector<std::unique_ptr<char[]>> slabs;
+    std::vector<char*> free_buffers;
+
+    void grow();
+};
+
+#endif
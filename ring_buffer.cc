@@ -0,0 +1,97 @@
+#include "ring_buffer.h"
+// C headers
+#include <cstring>
+// C++ headers
+#include <algorithm>
+
+RingBuffer::RingBuffer(int capacity, int slot_size, const SeqSpace& seq_space) : slots(capacity), 
+    size(slot_size), seq_space(seq_space), base(0), head(0), stored(0), 
+    payloads((size_t) capacity * slot_size), lengths(capacity, 0), 
+    crcs(capacity, 0), bitmap((capacity + 63) / 64, 0) {
+}
+
+void RingBuffer::reset(uint32_t base_seq) {
+    base = base_seq;
+    head = 0;
+    stored = 0;
+    std::fill(bitmap.begin(), bitmap.end(), 0);
+}
+
+void RingBuffer::resize(int capacity, int slot_size) {
+    slots = capacity;
+    size = slot_size;
+    payloads.assign((size_t) capacity * slot_size, 0);
+    lengths.assign(capacity, 0);
+    crcs.assign(capacity, 0);
+    bitmap.assign((capacity + 63) / 64, 0);
+    reset(base);
+}
+
+int RingBuffer::insert(uint32_t seq_number, const char* payload, int length, uint32_t crc) {
+    // distance from base_seq in the circular sequence space
+    uint64_t offset = seq_space.distance(base, seq_number);
+    if (offset % size != 0 || length > size || offset / size >= (uint64_t) slots) {
+        return -1;
+    }
+    int idx = offset / size;
+    if (has(idx)) {
+        return 1;
+    }
+    int p = physical(idx);
+    memcpy(payloads.data() + (size_t) p * size, payload, length);
+    lengths[p] = length;
+    crcs[p] = crc;
+    bitmap[p / 64] |= (uint64_t) 1 << (p % 64);
+    ++stored;
+    return 0;
+}
+
+bool RingBuffer::has(int idx) const {
+    int p = physical(idx);
+    return (bitmap[p / 64] >> (p % 64)) & 1;
+}
+
+const char* RingBuffer::data(int idx) const {
+    return payloads.data() + (size_t) physical(idx) * size;
+}
+
+int RingBuffer::length(int idx) const {
+    return lengths[physical(idx)];
+}
+
+uint32_t RingBuffer::crc(int idx) const {
+    return crcs[physical(idx)];
+}
+
+void RingBuffer::pop_front() {
+    if (has(0)) {
+        --stored;
+    }
+    bitmap[head / 64] &= ~((uint64_t) 1 << (head % 64));
+    base = seq_space.add(base, lengths[head]);
+    head = (head + 1) % slots;
+}
+
+int RingBuffer::received_ranges(SackBlock* blocks, int max_blocks) const {
+    int count = 0;
+    int seen = 0;
+    // consecutive full slots form one range, stop after the last stored slot
+    for (int i = 0; i < slots && seen != stored && count != max_blocks; ++i) {
+        if (!has(i)) {
+            continue;
+        }
+        uint32_t start = seq_space.add(base, (uint64_t) i * size);
+        uint64_t bytes = 0;
+        for (; i != slots && has(i); ++i) {
+            bytes += length(i);
+            ++seen;
+            if (length(i) != size) {
+                break;
+            }
+        }
+        blocks[count].start = start;
+        blocks[count].end = seq_space.add(start, bytes);
+        ++count;
+    }
+    return count;
+}
@@ -0,0 +1,69 @@
+#ifndef _RING_BUFFER_H_
+#define _RING_BUFFER_H_
+
+#include "seq_space.h"
+#include "packet.h"
+
+#include <vector>
+#include <cstdint>
+
+// Reassembly buffer for the receiver: a fixed number of payload slots stored in one contiguous
+// allocation, indexed by (seq_number - base_seq) / slot_size, plus a bitmap of received slots.
+// Slot 0 always holds the next expected in-order packet.
+class RingBuffer {
+public:
+    RingBuffer(int capacity, int slot_size, const SeqSpace& seq_space);
+
+    // start a new stream, base_seq is the next expected in-order sequence number
+    void reset(uint32_t base_seq);
+
+    // change the number and size of slots, drops all packets but keeps base_seq
+    void resize(int capacity, int slot_size);
+
+    // store payload of packet starting at seq_number, with the CRC32C of the payload if known, 
+    // returns 0 if stored, 1 if it is a duplicate and -1 if it falls outside of the buffer or 
+    // is not aligned to a slot
+    int insert(uint32_t seq_number, const char* payload, int length, uint32_t crc = 0);
+
+    bool has(int idx) const;
+
+    const char* data(int idx) const;
+
+    int length(int idx) const;
+
+    uint32_t crc(int idx) const;
+
+    // drop slot 0 and move base_seq after its payload
+    void pop_front();
+
+    // ranges of sequence numbers held in the buffer, lowest first, returns the number of 
+    // ranges written (at most max_blocks)
+    int received_ranges(SackBlock* blocks, int max_blocks) const;
+
+    uint32_t base_seq() const { return base; }
+
+    int capacity() const { return slots; }
+
+    int slot_size() const { return size; }
+
+    // number of packets held
+    int count() const { return stored; }
+
+private:
+    int slots;
+    int size;
+    SeqSpace seq_space;
+
+    uint32_t base; // sequence number of slot 0
+    int head;  // physical index of slot 0
+    int stored; // number of slots holding a packet
+
+    std::vector<char> payloads;
+    std::vector<int> lengths;
+    std::vector<uint32_t> crcs;
+    std::vector<uint64_t> bitmap;
+
+    int physical(int idx) const { return (head + idx) % slots; }
+};
+
+#endif
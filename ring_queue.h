@@ -0,0 +1,79 @@
+#ifndef _RING_QUEUE_H_
+#define _RING_QUEUE_H_
+
+#include <vector>
+#include <cstddef>
+
+// Double-ended queue in one circular array, indexed from the front. Unlike std::deque it 
+// doesn't allocate and free blocks as elements move through it; the array only doubles when
+// it is full.
+template <typename T>
+class RingQueue {
+public:
+    RingQueue() : head(0), count(0), items(16) {}
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+
+    T& operator[](size_t idx) { return items[(head + idx) & (items.size() - 1)]; }
+
+    const T& operator[](size_t idx) const { return items[(head + idx) & (items.size() - 1)]; }
+
+    T& front() { return (*this)[0]; }
+
+    T& back() { return (*this)[count - 1]; }
+
+    void push_back(const T& item) {
+        if (count == items.size()) {
+            grow();
+        }
+        items[(head + count) & (items.size() - 1)] = item;
+        ++count;
+    }
+
+    void pop_front() {
+        head = (head + 1) & (items.size() - 1);
+        --count;
+    }
+
+    void pop_back() { --count; }
+
+    class iterator {
+    public:
+        iterator(RingQueue* queue, size_t idx) : queue(queue), idx(idx) {}
+
+        T& operator*() const { return (*queue)[idx]; }
+
+        iterator& operator++() {
+            ++idx;
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const { return idx != other.idx; }
+
+    private:
+        RingQueue* queue;
+        size_t idx;
+    };
+
+    iterator begin() { return iterator(this, 0); }
+
+    iterator end() { return iterator(this, count); }
+
+private:
+    size_t head;
+    size_t count;
+    std::vector<T> items; // size is a power of 2
+
+    void grow() {
+        std::vector<T> larger(items.size() * 2);
+        for (size_t i = 0; i != count; ++i) {
+            larger[i] = (*this)[i];
+        }
+        items.swap(larger);
+        head = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,38 @@
+#include "rtt_estimator.h"
+// C++ headers
+#include <algorithm>
+// C headers
+#include <cstdlib>
+
+// clock granularity
+static const long GRANULARITY_US = 1000;
+
+RttEstimator::RttEstimator(long initial_rto_us, long min_rto_us, long max_rto_us) : srtt(-1), 
+    rttvar(0), rto(initial_rto_us), min_rto(min_rto_us), max_rto(max_rto_us) {
+    clamp();
+    base_rto = rto;
+}
+
+void RttEstimator::add_sample(long rtt_us) {
+    if (srtt < 0) {
+        // first measurement
+        srtt = rtt_us;
+        rttvar = rtt_us / 2;
+    }
+    else {
+        // alpha = 1/8, beta = 1/4
+        rttvar = (3 * rttvar + std::labs(srtt - rtt_us)) / 4;
+        srtt = (7 * srtt + rtt_us) / 8;
+    }
+    rto = srtt + std::max(GRANULARITY_US, 4 * rttvar);
+    clamp();
+    base_rto = rto;
+}
+
+void RttEstimator::backoff() {
+    rto = std::min(rto * 2, max_rto);
+}
+
+void RttEstimator::clamp() {
+    rto = std::max(min_rto, std::min(rto, max_rto));
+}
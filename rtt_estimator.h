@@ -0,0 +1,38 @@
+#ifndef _RTT_ESTIMATOR_H_
+#define _RTT_ESTIMATOR_H_
+
+// Retransmission timeout computed from measured round-trip times (RFC 6298): smoothed RTT and
+// RTT variance, exponential backoff on repeated timeouts and min/max clamps. Samples must only
+// be taken from packets that were not retransmitted (Karn's rule).
+class RttEstimator {
+public:
+    RttEstimator(long initial_rto_us, long min_rto_us, long max_rto_us);
+
+    void add_sample(long rtt_us);
+
+    // double RTO after a retransmission timeout, until the next sample
+    void backoff();
+
+    // the peer is alive again, drop the backoff without a new sample
+    void reset_backoff() { rto = base_rto; }
+
+    bool has_sample() const { return srtt >= 0; }
+
+    long srtt_us() const { return srtt; }
+
+    long rttvar_us() const { return rttvar; }
+
+    long rto_us() const { return rto; }
+
+private:
+    long srtt;   // -1 before the first sample
+    long rttvar;
+    long rto;
+    long base_rto; // rto without backoff
+    long min_rto;
+    long max_rto;
+
+    void clamp();
+};
+
+#endif
@@ -1,33 +1,170 @@
 // project headers
 #include "utils.h"
 #include "client.h"
+#include "fec.h"
 
 // C++ headers
 #include <cstdlib>
 #include <cstdio>
+#include <string>
 // LINUX headers
 
+// peak resident set size of this process in kB, -1 if unknown; unlike ru_maxrss it doesn't
+// include the memory of the process which exec'ed it
+static long peak_rss_kb() {
+    FILE* file = fopen("/proc/self/status", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    long rss = -1;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "VmHWM: %ld kB", &rss) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return rss;
+}
+
+// counters of the transfer as one JSON object, -1 on error
+static int write_stats(const std::string& path, const ClientOptions& options, 
+        const TransferStats& stats) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (file == NULL) {
+        return -1;
+    }
+    fprintf(file, "{\"cc\": \"%s\", \"bytes\": %ld, \"segment\": %d, "
+            "\"data_packets\": %ld, \"retransmissions\": %ld, \"parity_packets\": %ld, "
+            "\"recovered\": %ld, \"handshake_us\": %ld, \"transfer_us\": %ld, "
+            "\"close_us\": %ld, \"peak_rss_kb\": %ld}\n", 
+            options.congestion_control.c_str(), stats.bytes, stats.segment, stats.data_packets, 
+            stats.retransmissions, stats.parity_packets, stats.recovered, stats.handshake_us, 
+            stats.transfer_us, stats.close_us, peak_rss_kb());
+    return fclose(file) == 0 ? 0 : -1;
+}
+
 int main(int argc, char** argv) {
     // parse arguments
-    if (argc != 4) {
-        FATAL("invalid number of parameters,\nshould be `./client <HOSTNAME-OR-IP> <PORT> <FILENAME>`\n");
+    if (argc < 4) {
+        FATAL("invalid number of parameters,\nshould be `./client <HOSTNAME-OR-IP> <PORT> <FILENAME> [OPTIONS]`\n");
         exit(EXIT_FAILURE);
     }
     std::string ip_addr = argv[1];
     int port = std::atoi(argv[2]);
     std::string file_name = argv[3];
+    ClientOptions options;
+    std::string stats_path;
+    // largest segment offered to the server, full data packets of a jumbo frame by default
+    int max_segment = 9000 - UDP_IP_OVERHEAD - HEADER_SIZE;
+    for (int i = 4; i < argc; ++i) {
+        std::string value;
+        if (parse_option(argv[i], "read", value) && (value == "mmap" || value == "chunk")) {
+            // how the file is read: mapped, or in chunks of --chunk-size bytes
+            options.read_mode = value == "mmap" ? READ_MMAP : READ_CHUNK;
+        }
+        else if (parse_option(argv[i], "chunk-size", value) && std::atoi(value.c_str()) > 0) {
+            options.read_chunk_size = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "batch", value) && std::atoi(value.c_str()) > 0) {
+            // datagrams sent or received with one system call
+            options.batch_size = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "gso", value) && value.empty()) {
+            options.gso = true;
+        }
+        else if (parse_option(argv[i], "min-rto", value) && std::atoi(value.c_str()) > 0) {
+            // milliseconds
+            options.min_rto_us = std::atol(value.c_str()) * 1000;
+        }
+        else if (parse_option(argv[i], "max-rto", value) && std::atoi(value.c_str()) > 0) {
+            options.max_rto_us = std::atol(value.c_str()) * 1000;
+        }
+        else if (parse_option(argv[i], "cc", value) 
+                && (value == "reno" || value == "cubic" || value == "bbr")) {
+            // congestion control algorithm
+            options.congestion_control = value;
+        }
+        else if (parse_option(argv[i], "no-sack", value) && value.empty()) {
+            options.sack = false;
+        }
+        else if (parse_option(argv[i], "pacing", value) 
+                && (value == "timer" || value == "fq" || value == "none")) {
+            // none keeps the window in bursts
+            options.pacing = value;
+        }
+        else if (parse_option(argv[i], "mss", value) 
+                && std::atoi(value.c_str()) >= BASE_SEGMENT_SIZE) {
+            // bytes of payload, the segment is negotiated up to it
+            max_segment = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "no-pmtud", value) && value.empty()) {
+            // take the largest segment both ends accept without probing the path
+            options.pmtud = false;
+        }
+        else if (parse_option(argv[i], "netem", value)) {
+            // emulated impairments of the packets sent to the server, e.g. 
+            // loss=1%,delay=20ms,rate=100mbit (see parse_netem() in transport.h)
+            if (!parse_netem(value, options.netem)) {
+                FATAL("invalid netem spec: %s\n", value.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (parse_option(argv[i], "fec", value)) {
+            // forward error correction: --fec (blocks of 16 data packets), --fec=K or 
+            // --fec=K:M; the parity packets of a block follow the loss rate unless M is given
+            int k = 16;
+            int m = -1;
+            int fields = value.empty() ? 0 : sscanf(value.c_str(), "%d:%d", &k, &m);
+            if ((!value.empty() && fields < 1) || k < 1 || k > FEC_MAX_DATA 
+                    || (fields == 2 && (m < 0 || m > FEC_MAX_PARITY))) {
+                FATAL("invalid FEC blocks: %s\n", value.c_str());
+                exit(EXIT_FAILURE);
+            }
+            options.fec_block = k;
+            options.fec_parity = m;
+        }
+        else if (parse_option(argv[i], "checksum", value) && value.empty()) {
+            // packet checksums and the digest of the file, checked at FIN
+            options.checksum = true;
+        }
+        else if (parse_option(argv[i], "stats", value) && !value.empty()) {
+            // counters and timings of the transfer as JSON, for bench/run_bench.py
+            stats_path = value;
+        }
+        else if (parse_option(argv[i], "log", value) && !value.empty()) {
+            // binary event log, read it with ./decode_log
+#if LOG_LEVEL > LOG_LEVEL_INFO
+            FATAL("--log needs SEND/RECV logs, which this build compiles out\n");
+            exit(EXIT_FAILURE);
+#endif
+            if (open_event_log(value) == -1) {
+                print_sys_error("Unable to open event log");
+                exit(EXIT_FAILURE);
+            }
+        }
+        else {
+            FATAL("unknown option: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
     
     // initialize client
     int max_seq_num = 25600;
-    int max_packet_size = 524;
-    // controling the window size
+    int max_packet_size = max_segment + HEADER_SIZE;
+    // controling the window size, in base segments until the segment size is negotiated
     int cwnd = 512;
     int max_cwnd = 10240;
     int ssthresh = 5120;
-    int MSS = 512;
-    Client client(ip_addr, port, max_seq_num, max_packet_size, cwnd, max_cwnd, ssthresh, MSS);
+    int MSS = BASE_SEGMENT_SIZE;
+    Client client(ip_addr, port, max_seq_num, max_packet_size, cwnd, max_cwnd, ssthresh, MSS, 
+            options);
     
     // send file
     client.send_file(file_name);
+    if (!stats_path.empty() && write_stats(stats_path, options, client.stats()) == -1) {
+        print_sys_error("Unable to write stats");
+        exit(EXIT_FAILURE);
+    }
     return 0;
 }
@@ -5,22 +5,105 @@
 // C++ headers
 #include <cstdlib>
 #include <cstdio>
+#include <string>
 // LINUX headers
 
 int main(int argc, char** argv) {
     // parse arguments
-    if (argc != 2) {
-        FATAL("invalid number of parameters,\nshould be `./server <PORT>`\n");
+    if (argc < 2) {
+        FATAL("invalid number of parameters,\nshould be `./server <PORT> [OPTIONS]`\n");
         exit(EXIT_FAILURE);
     }
 
     int port = std::atoi(argv[1]);
+    ServerOptions options;
+    std::string log_path;
+    // largest segment accepted from clients, full data packets of a jumbo frame by default
+    int max_segment = 9000 - UDP_IP_OVERHEAD - HEADER_SIZE;
+    for (int i = 2; i < argc; ++i) {
+        std::string value;
+        if (parse_option(argv[i], "batch", value) && std::atoi(value.c_str()) > 0) {
+            options.batch_size = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "gro", value) && value.empty()) {
+            options.gro = true;
+        }
+        else if (parse_option(argv[i], "min-rto", value) && std::atoi(value.c_str()) > 0) {
+            // milliseconds
+            options.min_rto_us = std::atol(value.c_str()) * 1000;
+        }
+        else if (parse_option(argv[i], "max-rto", value) && std::atoi(value.c_str()) > 0) {
+            options.max_rto_us = std::atol(value.c_str()) * 1000;
+        }
+        else if (parse_option(argv[i], "mss", value) 
+                && std::atoi(value.c_str()) >= BASE_SEGMENT_SIZE) {
+            // bytes of payload, clients pick the segment up to it
+            max_segment = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "window", value) && std::atoi(value.c_str()) > 0) {
+            // receive window of 32-bit connections in bytes
+            options.recv_window = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "workers", value) && std::atoi(value.c_str()) > 0) {
+            options.workers = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "steer", value) && (value == "cpu" || value == "hash")) {
+            options.steer = value;
+        }
+        else if (parse_option(argv[i], "cpus", value) && !value.empty()) {
+            // comma separated, worker i runs on the i-th CPU (modulo the number of CPUs)
+            for (size_t pos = 0; pos != std::string::npos;) {
+                size_t comma = value.find(',', pos);
+                options.cpus.push_back(std::atoi(value.substr(pos, comma - pos).c_str()));
+                pos = comma == std::string::npos ? comma : comma + 1;
+            }
+        }
+        else if (parse_option(argv[i], "ack-every", value) && std::atoi(value.c_str()) > 0) {
+            // in-order packets per ACK, 1 acknowledges every packet
+            options.ack_every = std::atoi(value.c_str());
+        }
+        else if (parse_option(argv[i], "ack-delay", value) && std::atoi(value.c_str()) > 0) {
+            // microseconds
+            options.ack_delay_us = std::atol(value.c_str());
+        }
+        else if (parse_option(argv[i], "netem", value)) {
+            // emulated impairments of the packets sent to clients (see parse_netem() in 
+            // transport.h)
+            if (!parse_netem(value, options.netem)) {
+                FATAL("invalid netem spec: %s\n", value.c_str());
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (parse_option(argv[i], "log", value) && !value.empty()) {
+            // binary event log, read it with ./decode_log
+            log_path = value;
+        }
+        else {
+            FATAL("unknown option: %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!log_path.empty()) {
+#if LOG_LEVEL > LOG_LEVEL_INFO
+        FATAL("--log needs SEND/RECV logs, which this build compiles out\n");
+        exit(EXIT_FAILURE);
+#endif
+        // the event log has a single producer
+        if (options.workers > 1) {
+            FATAL("the event log needs a single worker\n");
+            exit(EXIT_FAILURE);
+        }
+        if (open_event_log(log_path) == -1) {
+            print_sys_error("Unable to open event log");
+            exit(EXIT_FAILURE);
+        }
+    }
 
     // initialize server
-    int max_packet_size = 524;
+    int max_packet_size = max_segment + HEADER_SIZE;
     int max_seq_number = 25600;
-    Server server(port, max_packet_size, max_seq_number);
-    server.listen();
+    serve(port, max_packet_size, max_seq_number, options);
 
     return 0;
 }
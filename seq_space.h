@@ -0,0 +1,35 @@
+#ifndef _SEQ_SPACE_H_
+#define _SEQ_SPACE_H_
+
+#include <cstdint>
+
+// Serial number arithmetic (RFC 1982) over a circular sequence space of `size` numbers: the 
+// legacy 25600-number space, or the full 32-bit space. A number is after another one if it is 
+// at most half of the space ahead of it, so windows must not exceed half of the space.
+class SeqSpace {
+public:
+    explicit SeqSpace(uint64_t size) : n(size) {}
+
+    uint64_t size() const { return n; }
+
+    // largest window which keeps comparisons unambiguous
+    uint64_t half() const { return n / 2; }
+
+    uint32_t add(uint32_t seq, uint64_t delta) const { return (seq + delta % n) % n; }
+
+    // how far `to` is ahead of `from`, in [0, size)
+    uint64_t distance(uint32_t from, uint32_t to) const { return (to + n - from) % n; }
+
+    // a is after b, i.e. 0 < a - b <= size / 2
+    bool after(uint32_t a, uint32_t b) const {
+        uint64_t d = distance(b, a);
+        return d != 0 && d <= half();
+    }
+
+    bool before(uint32_t a, uint32_t b) const { return a != b && !after(a, b); }
+
+private:
+    uint64_t n;
+};
+
+#endif
@@ -6,31 +6,98 @@
 #include <cstdlib>
 #include <cerrno>
 #include <cstring>
+#include <climits>
+#include <ctime>
 // C++ headers
 #include <string>
 #include <vector>
 #include <unordered_map>
-#include <list>
+#include <tuple>
 #include <algorithm>
+#include <memory>
+#include <thread>
 // LINUX headers
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/poll.h>
 #include <arpa/inet.h>
 #include <netinet/in.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/uio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <linux/filter.h>
 
 
-Server::Server(int port, int max_packet_size, int max_seq_number) : port(port), 
-    max_packet_size(max_packet_size), max_seq_number(max_seq_number) {
+// blocks of a session waiting for data or parity packets, the oldest one is dropped beyond
+static const size_t MAX_FEC_BLOCKS = 64;
+
+// header options of data packets beyond the 12-byte header
+static const int MAX_OPTIONS_ROOM = PACKED_HEADER_SIZE + FEC_OPTION_SIZE + CHECKSUM_OPTION_SIZE
+    - HEADER_SIZE;
+
+size_t AddrHash::operator()(const struct sockaddr_in& addr) const {
+    return std::hash<unsigned long>()(((unsigned long) addr.sin_addr.s_addr << 16) | addr.sin_port);
+}
+
+bool AddrEqual::operator()(const struct sockaddr_in& lhs, const struct sockaddr_in& rhs) const {
+    return lhs.sin_addr.s_addr == rhs.sin_addr.s_addr && lhs.sin_port == rhs.sin_port;
+}
+
+Session::Session(int capacity, int slot_size, uint8_t version, const SeqSpace& seq_space, 
+        const RttEstimator& rtt) 
+    : version(version), seq_space(seq_space), sack(false), max_segment(0), fec(false), 
+    checksum(false), buffer(capacity, slot_size, seq_space), recovered(0), digest(0), 
+    out_packet(NULL), out_length(0), unacked_packets(0), rtt(rtt), rtt_probe_us(-1) {
+}
+
+ServerOptions::ServerOptions() : batch_size(32), gro(false), min_rto_us(10000), 
+    max_rto_us(60000000), recv_window(1 << 20), workers(1), ack_every(2), ack_delay_us(1000) {
+}
+
+// block termination signals (in the calling thread and the threads it creates later) and 
+// receive them from a file descriptor
+static int create_signal_fd() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGQUIT);
+    sigaddset(&mask, SIGTERM);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        print_sys_error("Unable to call sigprocmask");
+        exit(EXIT_FAILURE);
+    }
+    int sigfd = signalfd(-1, &mask, 0);
+    if (sigfd == -1) {
+        print_sys_error("Unable to create signal fd");
+        exit(EXIT_FAILURE);
+    }  
+    return sigfd;
+}
+
+Server::Server(int port, int max_packet_size, int max_seq_number, 
+        const ServerOptions& options, int worker) : port(port), 
+    max_packet_size(max_packet_size), max_seq_number(max_seq_number), 
+    max_segment(max_packet_size - HEADER_SIZE), worker(worker), options(options), 
+    in_batch(options.batch_size, max_packet_size), out_batch(options.batch_size, max_packet_size), 
+    pool(max_packet_size, 64), next_client_id(worker + 1), 
+    initial_rtt(500000, options.min_rto_us, options.max_rto_us) { // 0.5 sec until RTT is sampled
     // initialize UDP socket
     if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
         print_sys_error("Unable to initialize UDP socket");
         exit(EXIT_FAILURE);
     }
+
+    // workers bind the same port, the kernel spreads clients over their sockets
+    int on = 1;
+    if (options.workers > 1 
+            && setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == -1) {
+        print_sys_error("Unable to set SO_REUSEPORT");
+        exit(EXIT_FAILURE);
+    }
     
     // address
     struct sockaddr_in server_addr;
@@ -46,85 +113,103 @@ Server::Server(int port, int max_packet_size, int max_seq_number) : port(port),
         exit(EXIT_FAILURE);
     }
 
-    // create timer file descriptor, nonblock
-    retrans_timerfd = timerfd_create(CLOCK_MONOTONIC, O_NONBLOCK);
-    timeout_timerfd = timerfd_create(CLOCK_MONOTONIC, O_NONBLOCK);
-    struct timespec TTL, TO, zero;
-    TTL.tv_sec = 0;
-    TTL.tv_nsec = 500000000; // 0.5 sec = 500 ms = 500000 us = 500000000 
-    TO.tv_sec = 10;
-    TO.tv_nsec = 0;
-    zero.tv_sec = 0;
-    zero.tv_nsec = 0;
-    RTO.it_value = TTL;
-    RTO.it_interval = zero;
-    time_out.it_value = TO;
-    time_out.it_interval = zero;
-
-    // create signal file descriptor
-    sigset_t mask;
-    sigemptyset(&mask);
-    sigaddset(&mask, SIGINT);
-    sigaddset(&mask, SIGQUIT);
-    sigaddset(&mask, SIGTERM);
-    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
-        print_sys_error("Unable to call sigprocmask");
-        exit(EXIT_FAILURE);
+    // packets go through the network emulator if any impairment is set, workers draw
+    // different random decisions
+    if (options.netem.enabled()) {
+        NetemOptions netem = options.netem;
+        netem.seed += worker;
+        transport.reset(new NetEmulator(sockfd, netem, max_packet_size));
     }
-    sigfd = signalfd(-1, &mask, 0);
-    if (sigfd == -1) {
-        print_sys_error("Unable to create signal fd");
+    else {
+        transport.reset(new Transport(sockfd));
+    }
+
+    // fall back to one datagram per packet if the kernel can't coalesce
+    if (options.gro && !in_batch.enable_gro(sockfd)) {
+        print_sys_error("UDP GRO unavailable, receiving without coalescing");
+    }
+
+    // each session creates its own timers in the event loop
+    time_out_us = 10000000;
+
+    // create signal file descriptor, workers are stopped by the main thread instead
+    sigfd = -1;
+    stopfd = -1;
+    if (options.workers == 1) {
+        sigfd = create_signal_fd();
+    }
+    else {
+        stopfd = eventfd(0, 0);
+    }
+    if (loop.add(sockfd) == -1 || loop.add(options.workers == 1 ? sigfd : stopfd) == -1) {
+        print_sys_error("Unable to watch socket");
         exit(EXIT_FAILURE);
-    }  
-    
-    // add sockfd, timerfd, sigfd to monitor
-    fds[0].fd = sockfd;
-    fds[0].events = POLLIN;
-    fds[1].fd = sigfd;
-    fds[1].events = POLLIN;
-    fds[2].fd = retrans_timerfd;
-    fds[2].events = POLLIN;
-    fds[3].fd = timeout_timerfd;
-    fds[3].events = POLLIN;
+    }
     
     // set random seed
     srand(time(0));
 }
 
 
-// write all packets to file, maintaining the relative order
-// but there might be gaps between them (due to packet loss)
-int Server::write_buffer_to_file(const Buffer& buffer) {
-    std::string filename = std::to_string(client_id) + ".file";
-    std::vector<char> content;
-    for (const auto& p : buffer) {
-        auto it = p.second.begin() + sizeof(Header);
-        std::copy(it, p.second.end(), std::back_inserter(content));
-    }
-    FILE *fp = fopen(filename.c_str(), "wb+");
-    if (fp == NULL) {
+// create the output file of a new client, data packets written already are read back to 
+// rebuild lost ones from parity packets
+int Server::open_file(Session& session) {
+    std::string filename = std::to_string(session.client_id) + ".file";
+    session.filefd = open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    session.file_offset = 0;
+    if (session.filefd == -1) {
         print_sys_error("Cannot open file to write");
-        return -1; 
+        return -1;
     }
-    fwrite(content.data(), sizeof(char), content.size(), fp);
-    fclose(fp);
     return 0;
 }
 
+// in-order payloads are already on disk, write the remaining out-of-order packets at their 
+// offsets, so there might be gaps between them (due to packet loss)
+int Server::write_buffer_to_file(Session& session) {
+    if (session.filefd == -1) {
+        return -1;
+    }
+    const RingBuffer& buffer = session.buffer;
+    int status = 0;
+    for (int i = 0; i != buffer.capacity(); ++i) {
+        if (!buffer.has(i)) {
+            continue;
+        }
+        off_t offset = session.file_offset + (off_t) i * buffer.slot_size();
+        if (pwrite(session.filefd, buffer.data(i), buffer.length(i), offset) == -1) {
+            print_sys_error("Cannot write file");
+            status = -1;
+        }
+    }
+    close(session.filefd);
+    session.filefd = -1;
+    return status;
+}
+
 void Server::release_resources() {
+    transport.reset();
     close(sockfd);
-    close(sigfd);
-    close(retrans_timerfd);
-    close(timeout_timerfd);
+    if (sigfd != -1) {
+        close(sigfd);
+    }
+    if (stopfd != -1) {
+        close(stopfd);
+    }
 }
 
 
-void Server::write_interrupt_to_file() {
-    std::string filename = std::to_string(client_id) + ".file";
-    FILE* file = fopen(filename.c_str(), "wb+");
-    const char* s = "INTERRUPT";
-    fwrite(s, sizeof(char), strlen(s), file);
-    fclose(file);
+// discard received data, the file only holds `mark`
+void Server::write_interrupt_to_file(Session& session, const char* mark) {
+    if (session.filefd == -1) {
+        return;
+    }
+    if (ftruncate(session.filefd, 0) == -1 
+            || pwrite(session.filefd, mark, strlen(mark), 0) == -1) {
+        print_sys_error("Cannot write file");
+    }
+    close(session.filefd);
+    session.filefd = -1;
 }
 
 void Server::catch_signal() {
@@ -136,11 +221,8 @@ void Server::catch_signal() {
     }
     if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGQUIT || fdsi.ssi_signo == SIGTERM) {
         // caught termination signal
-        FATAL("caught termination signal, exiting...\n")
-        // close socket
-        release_resources();
-        // write INTERRUPT to file
-        write_interrupt_to_file();
+        FATAL("caught termination signal, exiting...\n");
+        shutdown();
         exit(EXIT_SUCCESS);
     }
     else {
@@ -149,39 +231,94 @@ void Server::catch_signal() {
     }
 }
 
-void Server::write_syn_ack_packet(std::vector<char>& packet, Header& header, int& seq_number, 
-        int ack_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header));
-    header.seq_number = seq_number;
-    header.ack_number = ack_number;
-    header.syn = true;
-    header.ack = true;
-    memcpy(packet.data(), &header, sizeof(header));
-    seq_number = (seq_number + 1) % max_seq_number;
+// write INTERRUPT to files of all unfinished connections and close the socket
+void Server::shutdown() {
+    for (auto& e : sessions) {
+        write_interrupt_to_file(e.second, "INTERRUPT");
+    }
+    release_resources();
 }
 
-void Server::write_ack_packet(std::vector<char>& packet, Header& header, int seq_number, 
-        int ack_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header));
-    header.seq_number = seq_number;
-    header.ack_number = ack_number;
-    header.ack = true;
-    memcpy(packet.data(), &header, sizeof(header));
+void Server::stop() {
+    uint64_t one = 1;
+    if (write(stopfd, &one, sizeof(one)) != sizeof(one)) {
+        print_sys_error("Unable to stop worker");
+    }
+}
+
+// SYN-ACK packet, 32-bit connections advertise the receive window, SACK and the segment sizes 
+// in the payload, `probe` echoes a path MTU probe (0 if none); returns the size
+int Server::write_syn_ack_packet(const Session& session, char* packet, uint16_t probe) {
+    HeaderView header(packet);
+    header.reset_handshake(session.version);
+    // SYN-ACK took the sequence number before seq_number
+    header.set_seq_number(session.seq_space.add(session.seq_number, 
+                session.seq_space.size() - 1));
+    header.set_ack_number(session.expect_seq_number);
+    header.set_syn(true);
+    header.set_ack(true);
+    int length = header.size();
+    if (session.version >= SEQ32_VERSION) {
+        SynOptions syn_options;
+        syn_options.window = session.buffer.capacity() * session.buffer.slot_size();
+        syn_options.sack = session.sack;
+        syn_options.fec = session.fec;
+        syn_options.checksum = session.checksum;
+        if (session.max_segment != 0) {
+            syn_options.mss = session.max_segment;
+            syn_options.segment = session.buffer.slot_size();
+            syn_options.probe = probe;
+        }
+        length += encode_syn_options(syn_options, header.payload());
+    }
+    return length;
+}
+
+// cumulative ACK packet, followed by the out-of-order ranges of the buffer if SACK is on; 
+// FEC connections report the data packets rebuilt from parity packets
+void Server::write_ack_packet(Session& session, uint32_t ack_number) {
+    HeaderView header(session.out_packet);
+    header.reset(session.version);
+    header.set_seq_number(session.seq_number);
+    header.set_ack_number(ack_number);
+    header.set_ack(true);
+    HeaderOptions header_options;
+    header_options.recovered = session.fec ? session.recovered : 0;
+    header_options.checksum = session.checksum;
+    if (header_options.recovered != 0 || header_options.checksum) {
+        header.set_options_length(encode_header_options(header_options, header.options()));
+    }
+    int length = header.size();
+    SackBlock blocks[MAX_SACK_BLOCKS];
+    int count = session.sack ? session.buffer.received_ranges(blocks, MAX_SACK_BLOCKS) : 0;
+    if (count != 0) {
+        length += encode_sack_blocks(blocks, count, header.payload());
+    }
+    if (session.checksum) {
+        write_packet_checksum(session.out_packet, length);
+    }
+    session.out_length = length;
     // do not add 1 to seq_number
 }
 
-void Server::write_fin_ack_packet(std::vector<char>& packet, Header& header, int& seq_number, 
-        int ack_number) {
-    memset(&header, 0, sizeof(header));
-    packet.resize(sizeof(header));
-    header.seq_number = seq_number;
-    header.ack_number = ack_number;
-    header.ack = true;
-    header.fin = true;
-    memcpy(packet.data(), &header, sizeof(header));
-    seq_number = (seq_number + 1) % max_seq_number;
+// FIN-ACK packet, with the digest of the file written if the connection has checksums
+void Server::write_fin_ack_packet(Session& session, uint32_t ack_number) {
+    HeaderView header(session.out_packet);
+    header.reset(session.version);
+    header.set_seq_number(session.seq_number);
+    header.set_ack_number(ack_number);
+    header.set_ack(true);
+    header.set_fin(true);
+    if (session.checksum) {
+        HeaderOptions header_options;
+        header_options.has_digest = true;
+        header_options.digest = session.digest;
+        header_options.checksum = true;
+        header.set_options_length(encode_header_options(header_options, header.options()));
+        write_packet_checksum(session.out_packet, header.size());
+    }
+    session.out_length = header.size();
+    session.seq_number = session.seq_space.add(session.seq_number, 1);
 }
 
 /*
@@ -195,306 +332,637 @@ void Server::write_fin_packet(std::vector<char>& packet, Header& header, int& se
 }
 */
 
-void Server::hand_shaking(struct sockaddr_in& client_addr, std::vector<char>& ack_packet, 
-        Header& ack_header) {
-    std::vector<char> in_packet;
-    Header in_header;
-    for (;;) {
-        int val = poll(fds, 2, -1);
-        if (val < 0) {
-            // error occurs
-            print_sys_error("Bad poll calling");  
-        }
-        else {
-            if (fds[0].revents != 0) {
-                // expect SYN packet
-                recv_packet(sockfd, client_addr, in_packet, in_header, max_packet_size);
-                if (!in_header.syn) {
-                    // not a SYN packet, ignore
-                    fprintf(stderr, "ERR: Not a SYN packet, which will be ignored\n");
-                    continue;
-                }
-                print_log("RECV", in_header, 0, 0, false);
-                int ack_number = (in_header.seq_number + 1) % max_seq_number;
-                ack_header.ack_number = ack_number;
-                memcpy(ack_packet.data(), &ack_header, sizeof(ack_header));
-                if (send_packet(sockfd, client_addr, ack_packet) == -1) {
-                    print_sys_error("Unable to send SYN+ACK packet");
-                    continue; // shouldn't exit, because client may be just disconnected
-                }
-                print_log("SEND", ack_header, 0, 0, false);
-                // success, ready to receive data
-                break;
+static void insert_packet_to_buffer(RingBuffer& buffer, const char* in_packet, int length, 
+        const ConstHeaderView& in_header, uint32_t payload_crc) {
+    // the slot is found directly from the distance to the next in-order packet
+    int status = buffer.insert(in_header.seq_number(), in_header.payload(), 
+            length - in_header.size(), payload_crc);
+    if (status < 0) {
+        ERR("packet %u does not fit in the receive window, ignore\n", in_header.seq_number());
+    }
+    else if (status == 0) {
+        DEBUG("[OOO-PACKET] insert packet SEQ: %u\n", in_header.seq_number());
+    }
+    // otherwise duplicated out-of-order packet, do nothing
+}
+
+static void move_iter_forward(Session& session, uint32_t& ack_number) {
+    RingBuffer& buffer = session.buffer;
+    // write all packets tightly connected with the in-order packet, IOV_MAX of them per 
+    // system call
+    while (buffer.has(0)) {
+        struct iovec iov[IOV_MAX];
+        int count = 0;
+        size_t bytes = 0;
+        for (; count != IOV_MAX && count != buffer.capacity() && buffer.has(count); ++count) {
+            iov[count].iov_base = const_cast<char*>(buffer.data(count));
+            iov[count].iov_len = buffer.length(count);
+            bytes += iov[count].iov_len;
+            // full slots were read once already, to check their packets
+            if (session.checksum && buffer.length(count) == buffer.slot_size()) {
+                session.digest = session.slot_shift->combine(session.digest, buffer.crc(count));
             }
-            else if (fds[1].revents != 0) {
-                // signal captured
-                catch_signal();
+            else if (session.checksum) {
+                session.digest = crc32c(session.digest, buffer.data(count), buffer.length(count));
             }
         }
+        if (session.filefd != -1 && pwritev(session.filefd, iov, count, session.file_offset) 
+                != (ssize_t) bytes) {
+            print_sys_error("Cannot write file");
+        }
+        session.file_offset += bytes;
+        for (int i = 0; i != count; ++i) {
+            buffer.pop_front();
+        }
     }
+    // ack number is just seq_number of last in-order packet add payload
+    ack_number = buffer.base_seq();
 }
 
-void Server::insert_packet_to_buffer(Buffer& buffer, BuffIter& inorder_iter, 
-        const std::vector<char>& in_packet, const Header& in_header) {
-    // it is possible that inorder_iter is the end, if so, just insert to the end
-    BuffIter iter = inorder_iter;
-    int target_seq_number = in_header.seq_number;
-    while (iter != buffer.end()) {
-        printf("Isn't the last iter, moving\n");
-        // shift iter until meet a bigger element
-        int current_seq_number = iter->first.seq_number;
-        if (current_seq_number < target_seq_number - max_seq_number / 2) {
-            current_seq_number += max_seq_number;
+// a new client sends SYN packet, create a session and respond with a SYN-ACK packet
+void Server::hand_shaking(const struct sockaddr_in& client_addr, const char* in_packet, 
+        int length, const ConstHeaderView& in_header) {
+    // clients offer the highest version they know with SYN, older clients keep the legacy 
+    // space and a receive window of half of it; every connection starts with the base segment
+    uint8_t version = std::min(in_header.version(), (uint8_t) PACKED_VERSION);
+    SeqSpace seq_space(version >= SEQ32_VERSION ? SEQ32_SPACE : max_seq_number);
+    int payload_size = BASE_SEGMENT_SIZE;
+    int capacity = (max_seq_number / 2 + payload_size - 1) / payload_size;
+    if (version >= SEQ32_VERSION) {
+        capacity = std::max(options.recv_window / payload_size, 1);
+    }
+    Session& session = sessions.emplace(std::piecewise_construct, 
+            std::forward_as_tuple(client_addr), 
+            std::forward_as_tuple(capacity, payload_size, version, seq_space, initial_rtt))
+            .first->second;
+    session.client_id = next_client_id;
+    next_client_id += options.workers;
+    session.client_addr = client_addr;
+    session.state = ESTABLISHED;
+    if (version >= SEQ32_VERSION) {
+        SynOptions syn_options;
+        decode_syn_options(in_header.payload(), length - in_header.size(), syn_options);
+        session.sack = syn_options.sack;
+        session.fec = syn_options.fec && version >= PACKED_VERSION;
+        if (syn_options.mss >= BASE_SEGMENT_SIZE) {
+            session.max_segment = std::min((int) syn_options.mss, max_segment);
         }
-        if (target_seq_number < current_seq_number - max_seq_number / 2) {
-            target_seq_number += max_seq_number;
+        // the header options of data packets take room from the segment, which must keep 
+        // the base segment
+        session.checksum = syn_options.checksum && version >= PACKED_VERSION 
+            && session.max_segment >= BASE_SEGMENT_SIZE + MAX_OPTIONS_ROOM;
+        if (session.checksum) {
+            session.slot_shift.reset(new Crc32cShift(payload_size));
         }
-        if (current_seq_number < target_seq_number) {
-            // keep moving
-            printf("Keep moving\n");
-            ++iter;
+    }
+    session.seq_number = seq_space.add((uint32_t) rand() << 16 ^ rand(), 0);
+    uint32_t ack_number = seq_space.add(in_header.seq_number(), 1);
+    session.expect_seq_number = ack_number;
+    session.expect_ack_number = 0;
+    session.buffer.reset(ack_number);
+    session.out_packet = pool.acquire();
+    session.seq_number = seq_space.add(session.seq_number, 1);
+    session.out_length = write_syn_ack_packet(session, session.out_packet, 0);
+    open_file(session);
+    // create timers, both share the kernel timer of the event loop
+    session.retrans_timer = loop.create_timer();
+    session.timeout_timer = loop.create_timer();
+    session.ack_timer = loop.create_timer();
+    timer_owners[session.retrans_timer] = client_addr;
+    timer_owners[session.timeout_timer] = client_addr;
+    timer_owners[session.ack_timer] = client_addr;
+    // respond with a SYN-ACK packet
+    queue_packet(client_addr, session.out_packet, session.out_length);
+    PRINT_LOG_FROM_PACKET("SEND", session.out_packet, 0, 0, false);
+    session.rtt_probe_us = now_us();
+    loop.start_timer(session.timeout_timer, time_out_us);
+    loop.start_timer(session.retrans_timer, session.rtt.rto_us());
+}
+
+// acknowledge everything received in order, which also covers a pending delayed ACK
+void Server::send_ack(Session& session, bool dup) {
+    write_ack_packet(session, session.expect_seq_number);
+    queue_packet(session.client_addr, session.out_packet, session.out_length);
+    // a duplicated-ack is marked with [DUP] at the log
+    PRINT_LOG_FROM_PACKET("SEND", session.out_packet, 0, 0, dup);
+    session.unacked_packets = 0;
+    loop.stop_timer(session.ack_timer);
+}
+
+// the receive path shared with bench/bench_micro.cc, see server.h
+bool store_data_packet(Session& session, const char* in_packet, int length, 
+        const ConstHeaderView& in_header, uint32_t payload_crc) {
+    RingBuffer& buffer = session.buffer;
+    uint32_t& expect_seq_number = session.expect_seq_number;
+    if (in_header.seq_number() == expect_seq_number) {
+        // in order packet, store at the front of the buffer
+        insert_packet_to_buffer(buffer, in_packet, length, in_header, payload_crc);
+        // move forward, possibly connect all out-of-order packets
+        uint32_t ack_number; // for reference out
+        move_iter_forward(session, ack_number);
+        // update next expected in-order seq_number
+        expect_seq_number = ack_number;
+        DEBUG("[INORDER-PACK] next_expected_seq: %u\n", expect_seq_number);
+        return true;
+    }
+    if (session.seq_space.after(in_header.seq_number(), expect_seq_number)) {
+        // detect packet loss, keep this packet until the gap is filled
+        insert_packet_to_buffer(buffer, in_packet, length, in_header, payload_crc);
+    }
+    return false;
+}
+
+// in-order packets are acknowledged every ack_every packets or after ack_delay_us, while 
+// out-of-order packets, duplicates and packets filling a gap are acknowledged at once
+void Server::recv_data_to_buffer(Session& session, const char* in_packet, int length, 
+        const ConstHeaderView& in_header, uint32_t payload_crc) {
+    RingBuffer& buffer = session.buffer;
+    // out-of-order packets wait behind the next in-order one
+    bool fills_gap = buffer.count() != 0;
+    if (store_data_packet(session, in_packet, length, in_header, payload_crc)) {
+        // build an cumulative ACK packet and reply, or wait for the next packet
+        session.unacked_packets += 1;
+        if (fills_gap || session.unacked_packets >= options.ack_every) {
+            send_ack(session, false);
         }
-        else if (current_seq_number == target_seq_number) {
-            // duplicated out-of-order packet, do nothing
-            return;
+        else if (!loop.timer_active(session.ack_timer)) {
+            loop.start_timer(session.ack_timer, options.ack_delay_us);
         }
-        else { // current_seq_number > target_seq_number
-            // good
+    } 
+    else {
+        // write a duplicated-ack, which reports the new out-of-order packet with SACK
+        send_ack(session, true);
+    }
+    // the packet may leave few enough data packets of its block missing for the parity 
+    // packets received
+    for (size_t i = 0; i != session.fec_blocks.size(); ++i) {
+        const FecBlock& block = session.fec_blocks[i];
+        uint64_t distance = session.seq_space.distance(block.start, in_header.seq_number());
+        if (distance < (uint64_t) block.k * buffer.slot_size()) {
+            recover_data(session, i);
             break;
         }
     }
-    // insert new packet before iter
-    BuffIter temp_iter = buffer.insert(iter, std::make_pair(in_header, in_packet));
-    //if (inorder_iter == buffer.end())
-    if (inorder_iter == iter)
-        inorder_iter = temp_iter;
-    printf("[OOO-PACKET] insert packet %lu, SEQ: %d\n", buffer.size(), in_header.seq_number);
-    print_buffer(buffer);
 }
 
-void Server::move_iter_forward(Buffer& buffer, BuffIter& inorder_iter, int& ack_number) {
-    BuffIter next_iter = std::next(inorder_iter);
-    for (;;) {
-        if (next_iter == buffer.end()) {
-            printf("next_iter == buffer.end()\n");
+// keep a parity packet with its block until the missing data packets can be rebuilt
+void Server::recv_parity(Session& session, const char* in_packet, int length, 
+        const ConstHeaderView& in_header, const HeaderOptions& header_options) {
+    const SeqSpace& seq_space = session.seq_space;
+    int segment = session.buffer.slot_size();
+    int k = header_options.fec_block;
+    int index = header_options.fec_position - k;
+    if (length - in_header.size() != segment || k > FEC_MAX_DATA || index >= FEC_MAX_PARITY) {
+        return;
+    }
+    // blocks before the next in-order packet are complete
+    while (!session.fec_blocks.empty()) {
+        const FecBlock& oldest = session.fec_blocks.front();
+        uint32_t end = seq_space.add(oldest.start, (uint64_t) oldest.k * segment);
+        if (seq_space.after(end, session.expect_seq_number)) {
             break;
         }
-        // does next_iter is tightly connected with inorder_iter?
-        int inorder_seq_number = inorder_iter->first.seq_number;
-        int payload = inorder_iter->second.size() - sizeof(Header);
-        int next_seq_number = next_iter->first.seq_number;
-        printf("May move iter: inorder_seq: %d + payload: %d =? next_seq: %d\n", inorder_seq_number, payload, next_seq_number);
-        if (((inorder_seq_number + payload) % max_seq_number) == next_seq_number) {
-            ++inorder_iter;
-            ++next_iter;
+        release_block(session, 0);
+    }
+    uint32_t start = in_header.seq_number();
+    uint32_t end = seq_space.add(start, (uint64_t) k * segment);
+    if (!seq_space.after(end, session.expect_seq_number)) {
+        return;
+    }
+    size_t i = 0;
+    while (i != session.fec_blocks.size() && session.fec_blocks[i].start != start) {
+        ++i;
+    }
+    if (i == session.fec_blocks.size()) {
+        if (session.fec_blocks.size() == MAX_FEC_BLOCKS) {
+            release_block(session, 0);
+            --i;
+        }
+        FecBlock block;
+        block.start = start;
+        block.k = k;
+        block.count = 0;
+        session.fec_blocks.push_back(block);
+    }
+    FecBlock& block = session.fec_blocks[i];
+    for (int j = 0; j != block.count; ++j) {
+        if (block.index[j] == index) {
+            // duplicated parity packet
+            return;
+        }
+    }
+    block.index[block.count] = index;
+    block.parity[block.count] = pool.acquire();
+    memcpy(block.parity[block.count], in_header.payload(), segment);
+    ++block.count;
+    DEBUG("[FEC-PARITY] block SEQ: %u, parity %d\n", start, index);
+    recover_data(session, i);
+}
+
+// Rebuild the missing data packets of a block into the buffer if enough parity packets 
+// arrived, the data packets received are in the buffer or were written to the file already.
+// Returns true once every data packet of the block is in.
+bool Server::recover_block(Session& session, const FecBlock& block) {
+    RingBuffer& buffer = session.buffer;
+    const SeqSpace& seq_space = session.seq_space;
+    int segment = buffer.slot_size();
+    uint32_t seq_numbers[FEC_MAX_DATA];
+    const char* data[FEC_MAX_DATA];
+    int missing = 0;
+    int written = 0;
+    for (int i = 0; i != block.k; ++i) {
+        seq_numbers[i] = seq_space.add(block.start, (uint64_t) i * segment);
+        data[i] = NULL;
+        if (seq_space.before(seq_numbers[i], session.expect_seq_number)) {
+            ++written;
+            continue;
+        }
+        uint64_t idx = seq_space.distance(session.expect_seq_number, seq_numbers[i]) / segment;
+        if (idx < (uint64_t) buffer.capacity() && buffer.has(idx)) {
+            data[i] = buffer.data(idx);
         }
         else {
-            break;
+            ++missing;
         }
     }
-    // ack number is just seq_number of last in-order packet add payload
-    int payload = inorder_iter->second.size() - sizeof(Header);
-    ack_number = (inorder_iter->first.seq_number + payload) % max_seq_number;
-    // move inorder_iter forward
-    ++inorder_iter;
-}
-
-int Server::recv_data_to_buffer(struct sockaddr_in& client_addr, std::vector<char>& in_packet, 
-        Header& in_header, std::vector<char>& out_packet, Header& out_header, 
-        std::list<DataPacket>& buffer, int seq_number, int expect_seq_number) {
-    // pointer to last in-order packet
-    auto inorder_iter = buffer.begin();
-    // reset timeout timer
-    reset_timer(timeout_timerfd, time_out);
-    for (;;) {
-        // reset retransmission timer before polling
-        reset_timer(retrans_timerfd, RTO); 
-        int val = poll(fds, 4, -1);
-        if (val < 0) {
-            print_sys_error("Bad poll calling");
-            exit(EXIT_FAILURE);
+    if (missing == 0) {
+        return true;
+    }
+    if (missing > block.count || (written != 0 && session.filefd == -1)) {
+        return false;
+    }
+    // data packets written already, then the rebuilt ones
+    fec_scratch.resize((size_t) (written + missing) * segment);
+    char* recovered[FEC_MAX_PARITY];
+    char* next = fec_scratch.data();
+    for (int i = 0; i != block.k; ++i) {
+        if (data[i] != NULL 
+                || !seq_space.before(seq_numbers[i], session.expect_seq_number)) {
+            continue;
         }
-        if (fds[0].revents != 0) {
-            recv_packet(sockfd, client_addr, in_packet, in_header, max_packet_size);
-            print_log("RECV", in_header, 0, 0, false);
-            // expect an ACK or FIN packet
-            if (in_header.ack) {
-
-                if (in_header.seq_number == expect_seq_number) {
-                    // in order packet, insert after inorder_iter
-                    inorder_iter = buffer.insert(inorder_iter, std::make_pair(in_header, in_packet));
-                    printf("[INORDER-PACK] insert packet: %lu, SEQ: %d\n", buffer.size(), 
-                            in_header.seq_number);
-                    print_buffer(buffer);
-                    // move iterator forward, possibly connect all out-of-order packets
-                    int ack_number; // for reference out
-                    move_iter_forward(buffer, inorder_iter, ack_number);
-                    // build an cumulative ACK packet and reply
-                    write_ack_packet(out_packet, out_header, seq_number, ack_number);
-                    send_packet(sockfd, client_addr, out_packet);
-                    print_log("SEND", out_header, 0, 0, false);
-                    // update next expected in-order seq_number
-                    expect_seq_number = ack_number;
-                    printf("[INORDER-PACK] next_expected_seq: %d\n", expect_seq_number);
-                } 
-                else {
-                    int in_seq_number = in_header.seq_number;
-                    if (in_seq_number < expect_seq_number - max_seq_number / 2) {
-                        in_seq_number += max_seq_number;
-                    }
-                    else if (expect_seq_number < in_seq_number - max_seq_number / 2) {
-                        in_seq_number -= max_seq_number;
-                    }
-                    if (in_seq_number > expect_seq_number) {
-                        // detect packet loss, insert this packet with linear search
-                        insert_packet_to_buffer(buffer, inorder_iter, in_packet, in_header);
-                    }
-                    // write a duplicated-ack with lastest ack packet
-                    send_packet(sockfd, client_addr, out_packet);
-                    // this is a duplicated-ack, so add [DUP] at the log
-                    print_log("SEND", out_header, 0, 0, true);
-                }
+        off_t offset = session.file_offset 
+            - seq_space.distance(seq_numbers[i], session.expect_seq_number);
+        if (pread(session.filefd, next, segment, offset) != segment) {
+            print_sys_error("Cannot read file");
+            return false;
+        }
+        data[i] = next;
+        next += segment;
+    }
+    for (int t = 0; t != missing; ++t) {
+        recovered[t] = next + (size_t) t * segment;
+    }
+    fec_decode(block.k, segment, data, block.count, block.index, block.parity, recovered);
+    int t = 0;
+    for (int i = 0; i != block.k; ++i) {
+        if (data[i] == NULL) {
+            uint32_t crc = session.checksum ? crc32c(0, recovered[t], segment) : 0;
+            buffer.insert(seq_numbers[i], recovered[t++], segment, crc);
+            DEBUG("[FEC-RECOVER] rebuilt packet SEQ: %u\n", seq_numbers[i]);
+        }
+    }
+    session.recovered += missing;
+    return true;
+}
+
+// try to complete the block, the rebuilt packets are acknowledged at once if they fill the 
+// gap before the buffer
+void Server::recover_data(Session& session, size_t block_idx) {
+    if (!recover_block(session, session.fec_blocks[block_idx])) {
+        return;
+    }
+    release_block(session, block_idx);
+    if (session.buffer.has(0)) {
+        uint32_t ack_number;
+        move_iter_forward(session, ack_number);
+        session.expect_seq_number = ack_number;
+        send_ack(session, false);
+    }
+}
+
+void Server::release_block(Session& session, size_t block_idx) {
+    FecBlock& block = session.fec_blocks[block_idx];
+    for (int j = 0; j != block.count; ++j) {
+        pool.release(block.parity[j]);
+    }
+    session.fec_blocks.erase(session.fec_blocks.begin() + block_idx);
+}
+
+// client sends FIN packet, respond with FIN-ACK and wait for the last ACK
+void Server::close_connection(Session& session, const ConstHeaderView& in_header) {
+    // in_header stores FIN packet
+    uint32_t ack_number = session.seq_space.add(in_header.seq_number(), 1);
+    if (session.checksum) {
+        // the file is useless unless it holds the data sent, FIN-ACK tells the client
+        HeaderOptions header_options;
+        decode_header_options(in_header.options(), in_header.options_length(), header_options);
+        if (!header_options.has_digest || header_options.digest != session.digest) {
+            ERR("client %d: file digest %08x, the client sent %08x\n", session.client_id, 
+                    session.digest, header_options.digest);
+            write_interrupt_to_file(session, "CORRUPTED");
+        }
+    }
+    // FIN-ACK acknowledges everything
+    loop.stop_timer(session.ack_timer);
+    write_fin_ack_packet(session, ack_number);
+    // send FIN-ACK packet
+    queue_packet(session.client_addr, session.out_packet, session.out_length);
+    PRINT_LOG_FROM_PACKET("SEND", session.out_packet, 0, 0, false);
+    session.expect_ack_number = session.seq_number;
+    session.state = CLOSING;
+}
+
+// no packet from the client within RTO, resend latest out_packet
+void Server::retransmission_timeout(Session& session) {
+    queue_packet(session.client_addr, session.out_packet, session.out_length);
+    PRINT_LOG_FROM_PACKET("SEND", session.out_packet, 0, 0, session.state == ESTABLISHED);
+    // back off until the client answers
+    session.rtt_probe_us = -1;
+    session.rtt.backoff();
+    loop.start_timer(session.retrans_timer, session.rtt.rto_us());
+}
+
+// replies are sent together after handling all received packets
+void Server::queue_packet(const struct sockaddr_in& addr, const char* packet, int length) {
+    out_batch.push(addr, packet, length);
+    if (out_batch.full()) {
+        flush_packets();
+    }
+}
+
+void Server::flush_packets() {
+    // shouldn't exit, because client may be just disconnected
+    if (!out_batch.empty() && out_batch.send(*transport) < 0) {
+        print_sys_error("Unable to send packet");
+    }
+}
+
+// write data buffer to file and forget the client
+void Server::remove_session(SessionTable::iterator it) {
+    Session& session = it->second;
+    write_buffer_to_file(session);
+    while (!session.fec_blocks.empty()) {
+        release_block(session, 0);
+    }
+    pool.release(session.out_packet);
+    timer_owners.erase(session.retrans_timer);
+    timer_owners.erase(session.timeout_timer);
+    timer_owners.erase(session.ack_timer);
+    loop.destroy_timer(session.retrans_timer);
+    loop.destroy_timer(session.timeout_timer);
+    loop.destroy_timer(session.ack_timer);
+    sessions.erase(it);
+}
+
+// SYN of a known client: SYN-ACK may be lost, or the client probes the path MTU or picks the 
+// segment size before sending data
+void Server::answer_syn(Session& session, const char* in_packet, int length, 
+        const ConstHeaderView& in_header) {
+    session.rtt_probe_us = -1;
+    SynOptions syn_options;
+    if (session.version >= SEQ32_VERSION) {
+        decode_syn_options(in_header.payload(), length - in_header.size(), syn_options);
+    }
+    // the segment is only changed while the buffer holds nothing
+    bool receiving = session.file_offset != 0 || session.buffer.count() != 0;
+    if (syn_options.probe != 0) {
+        // echo the probe if it arrived whole, late probes are dropped
+        if (!receiving && syn_options.probe <= session.max_segment 
+                && length >= header_size(session.version) + syn_options.probe) {
+            char* reply = out_batch.next();
+            out_batch.push(session.client_addr, write_syn_ack_packet(session, reply, 
+                        syn_options.probe));
+            PRINT_LOG_FROM_PACKET("SEND", reply, 0, 0, false);
+            if (out_batch.full()) {
+                flush_packets();
+            }
+        }
+        return;
+    }
+    if (!receiving && syn_options.segment >= BASE_SEGMENT_SIZE 
+            && syn_options.segment <= session.max_segment) {
+        // the window keeps its size in bytes
+        int capacity = std::max(options.recv_window / syn_options.segment, 1);
+        session.buffer.resize(capacity, syn_options.segment);
+        if (session.checksum) {
+            session.slot_shift.reset(new Crc32cShift(syn_options.segment));
+        }
+        session.out_length = write_syn_ack_packet(session, session.out_packet, 0);
+    }
+    // resend latest out_packet
+    queue_packet(session.client_addr, session.out_packet, session.out_length);
+    PRINT_LOG_FROM_PACKET("SEND", session.out_packet, 0, 0, true);
+}
+
+// route a packet to the session of its sender
+void Server::dispatch_packet(const struct sockaddr_in& client_addr, 
+        const char* in_packet, int length, const ConstHeaderView& in_header) {
+    auto it = sessions.find(client_addr);
+    if (it == sessions.end()) {
+        // unknown client, expect SYN packet
+        if (!in_header.syn()) {
+            // not a SYN packet, ignore
+            fprintf(stderr, "ERR: Not a SYN packet, which will be ignored\n");
+            return;
+        }
+        /*
+         * Hand shaking stage
+         */
+        hand_shaking(client_addr, in_packet, length, in_header);
+        return;
+    }
+    Session& session = it->second;
+    uint32_t payload_crc = 0;
+    if (session.checksum && !in_header.syn() 
+            && !packet_checksum_ok(in_packet, length, &payload_crc)) {
+        // corrupted, dropped as if lost so that the client sends it again
+        DEBUG("[CORRUPT] drop packet SEQ: %u\n", in_header.seq_number());
+        return;
+    }
+    if (session.state == ESTABLISHED) {
+        /*
+         * Receive data packets, expect an ACK or FIN packet
+         */
+        if (in_header.ack()) {
+            if (session.rtt_probe_us >= 0) {
+                // the first data packet answers SYN-ACK
+                session.rtt.add_sample(now_us() - session.rtt_probe_us);
+                session.rtt_probe_us = -1;
             }
-            else if (in_header.fin) {
-                // close connection
-                break;
+            HeaderOptions header_options;
+            if (session.fec) {
+                decode_header_options(in_header.options(), in_header.options_length(), 
+                        header_options);
+            }
+            if (header_options.parity()) {
+                recv_parity(session, in_packet, length, in_header, header_options);
             }
             else {
-                fprintf(stderr, "ERR: not a ACK or FIN packet\n");
+                recv_data_to_buffer(session, in_packet, length, in_header, payload_crc);
             }
-            // reset timeout timer
-            reset_timer(timeout_timerfd, time_out); 
         }
-        else if (fds[1].revents != 0) {
-            fprintf(stderr, "WARN: caught an interruption signal, exiting...\n");
-            // catch signal and exit
-            catch_signal();
+        else if (in_header.fin()) {
+            /*
+             * FIN-ACK stage
+             */
+            close_connection(session, in_header);
+        }
+        else if (in_header.syn()) {
+            answer_syn(session, in_packet, length, in_header);
         }
-        else if (fds[2].revents != 0) {
-            // retransmission timeout, resend latest out_packet
-            send_packet(sockfd, client_addr, out_packet);
-            print_log("SEND", out_header, 0, 0, true);
+        else {
+            fprintf(stderr, "ERR: not a ACK or FIN packet\n");
         }
-        else if (fds[3].revents != 0) {
+    }
+    else if (in_header.ack() && in_header.ack_number() == session.expect_ack_number) {
+        // connection closed
+        remove_session(it);
+        return;
+    }
+    // reset timeout and retransmission timer, bc we have received message from client, 
+    // neither needs a system call
+    loop.start_timer(session.timeout_timer, time_out_us); 
+    session.rtt.reset_backoff();
+    loop.start_timer(session.retrans_timer, session.rtt.rto_us());
+}
+
+// a session timer expired
+void Server::handle_timer(int timer) {
+    auto owner = timer_owners.find(timer);
+    if (owner == timer_owners.end()) {
+        return;
+    }
+    auto it = sessions.find(owner->second);
+    Session& session = it->second;
+    if (timer == session.timeout_timer) {
+        if (session.state == ESTABLISHED) {
             // timeout, exit from this connection
             fprintf(stderr, "ERR: connection timeout, disconnect...\n");
-            return -1; 
         }
+        // otherwise the last ACK is lost, force close
+        remove_session(it);
+    }
+    else if (timer == session.ack_timer) {
+        // no further in-order packet within the delay
+        send_ack(session, false);
+    }
+    else {
+        retransmission_timeout(session);
     }
-    return 0; 
 }
 
-void Server::close_connection(struct sockaddr_in& client_addr, std::vector<char>& in_packet, 
-            Header& in_header, std::vector<char>& out_packet, Header& out_header, int seq_number) {
-    // in_header stores FIN packet
-    int ack_number = (in_header.seq_number + 1) % max_seq_number;
-    write_fin_ack_packet(out_packet, out_header, seq_number, ack_number);
-    // send FIN-ACK packet
-    send_packet(sockfd, client_addr, out_packet);
-    print_log("SEND", out_header, 0, 0, false);
-    //write_fin_packet(out_packet, out_header, seq_number);
-    // send FIN packet
-    //send_packet(sockfd, client_addr, out_packet);
-    //print_log("SEND", out_header, 0, 0, false);
-    int expect_ack_number = seq_number; //(seq_number + 1) % max_seq_number;
-    reset_timer(timeout_timerfd, time_out);
+// pin the calling thread to the CPU of the worker
+void Server::set_affinity() {
+    if (options.cpus.empty()) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(options.cpus[worker % options.cpus.size()], &set);
+    int status = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    if (status != 0) {
+        errno = status;
+        print_sys_error("Unable to set CPU affinity");
+    }
+}
+
+void Server::listen() {
+    set_affinity();
+    // event loop, serving all clients at the same time
     for (;;) {
-        reset_timer(retrans_timerfd, RTO);
-        int val = poll(fds, 4, -1);
-        if (val < 0) {
-            print_sys_error("Bad poll calling");
+        if (loop.wait() < 0) {
+            print_sys_error("Bad epoll calling");
             exit(EXIT_FAILURE);
         }
-        if (fds[0].revents != 0) {
-            recv_packet(sockfd, client_addr, in_packet, in_header, max_packet_size);
-            print_log("RECV", in_header, 0, 0, false);
-            if (in_header.ack && in_header.ack_number == expect_ack_number) {
-                break;
+        if (loop.readable(sockfd)) {
+            // handle all packets waiting in the socket
+            int received = in_batch.recv(sockfd, MSG_DONTWAIT);
+            for (int k = 0; k < received; ++k) {
+                if (!header_complete(in_batch.data(k), in_batch.length(k))) {
+                    continue;
+                }
+                // the header is read in place
+                ConstHeaderView in_header(in_batch.data(k));
+                PRINT_LOG_FROM_PACKET("RECV", in_batch.data(k), 0, 0, false);
+                dispatch_packet(in_batch.addr(k), in_batch.data(k), in_batch.length(k), in_header);
             }
-            reset_timer(timeout_timerfd, time_out);
         }
-        else if (fds[1].revents != 0) {
-            // catch signal and exit
+        if (sigfd != -1 && loop.readable(sigfd)) {
+            // received signal to quit the program
             catch_signal();
         }
-        else if (fds[2].revents != 0) {
-            // retransmission timeout
-            send_packet(sockfd, client_addr, out_packet);
-            print_log_from_packet("SEND", out_packet, 0, 0, false);
+        if (stopfd != -1 && loop.readable(stopfd)) {
+            // the main thread received the signal
+            shutdown();
+            return;
         }
-        else if (fds[3].revents != 0) {
-            // timeout, force close
-            break;
+        for (int timer : loop.expired_timers()) {
+            // the timer may be restarted or its session closed while handling the socket
+            if (loop.expired_timer(timer)) {
+                handle_timer(timer);
+            }
         }
+        flush_packets();
     }
 }
 
-void Server::listen() {
-    // in & out packets
-    std::vector<char> in_packet, out_packet;
-    Header in_header, out_header;
-    //std::vector<char> packet_buffer(max_packet_size);
-    //Header header_buffer;
-    // event loop, one iteration for each client
-    for (client_id = 1;; ++client_id) {
-        // store data in a doubly-linked list
-        std::list<DataPacket> data_buffer;
-        // client address information
-        struct sockaddr_in client_addr;
-        memset(&client_addr, 0, sizeof(client_addr));
-        
-        /*
-         * Listen to any client
-         */
-        for (;;) {
-            // wait only on the sockfd and signal
-            int val = poll(fds, 2, -1);
-            if (val < 0) {
-                print_sys_error("Bad poll calling");
-                exit(EXIT_FAILURE);
-            }
-            if (fds[0].revents != 0) {
-                // check SYN packet
-                recv_packet(sockfd, client_addr, in_packet, in_header, max_packet_size);
-                print_log("RECV", in_header, 0, 0, false);
-                if (in_header.syn) {
-                    break;
-                }
-            }
-            else if (fds[1].revents != 0){
-                // received signal to quit the program
-                catch_signal();
-            }
+// classic BPF program of the reuseport group, returns the index of the worker socket
+static int attach_steering_program(int sockfd, const std::string& steer, int workers) {
+    uint32_t field = steer == "cpu" ? SKF_AD_CPU : SKF_AD_RXHASH;
+    struct sock_filter code[] = {
+        {BPF_LD | BPF_W | BPF_ABS, 0, 0, (uint32_t) SKF_AD_OFF + field},
+        {BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t) workers},
+        {BPF_RET | BPF_A, 0, 0, 0}
+    };
+    struct sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+    return setsockopt(sockfd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program));
+}
+
+// one server per worker thread, nothing is shared between them: each has its own socket,
+// sessions and timers, and numbers its clients apart from the others
+void serve(int port, int max_packet_size, int max_seq_number, const ServerOptions& options) {
+    if (options.workers == 1) {
+        Server server(port, max_packet_size, max_seq_number, options);
+        server.listen();
+        return;
+    }
+    // before any thread is created, so that they all block the signals
+    int sigfd = create_signal_fd();
+    // sockets join the reuseport group in the order of the workers
+    std::vector<std::unique_ptr<Server>> servers;
+    for (int i = 0; i != options.workers; ++i) {
+        servers.emplace_back(new Server(port, max_packet_size, max_seq_number, options, i));
+    }
+    if (!options.steer.empty() 
+            && attach_steering_program(servers[0]->sockfd, options.steer, options.workers) == -1) {
+        print_sys_error("Unable to attach steering program");
+        exit(EXIT_FAILURE);
+    }
+    std::vector<std::thread> threads;
+    for (auto& server : servers) {
+        threads.emplace_back(&Server::listen, server.get());
+    }
+    // wait for a termination signal, then stop every worker
+    for (;;) {
+        struct signalfd_siginfo fdsi;
+        if (read(sigfd, &fdsi, sizeof(fdsi)) != sizeof(fdsi)) {
+            print_sys_error("Unable to read signalfd");
+            exit(EXIT_FAILURE);
         }
-         
-        /*
-         * Hand shaking stage
-         */
-        int seq_number = rand() % max_seq_number;
-        int ack_number = (in_header.seq_number + 1) % max_seq_number;
-        write_syn_ack_packet(out_packet, out_header, seq_number, ack_number);
-        // respond with a SYN-ACK packet
-        send_packet(sockfd, client_addr, out_packet);
-        print_log("SEND", out_header, 0, 0, false);
-        //int first_seq_number = out_header.ack_number;
-        
-        /*
-         * Receive data packets
-         */
-        int expect_seq_number = ack_number;
-        int status = recv_data_to_buffer(client_addr, in_packet, in_header, out_packet, 
-                out_header, data_buffer, seq_number, expect_seq_number);
-        if (status != -1) {
-            /*
-             * FIN-ACK stage
-             */
-            close_connection(client_addr, in_packet, in_header, out_packet, out_header, seq_number);
+        if (fdsi.ssi_signo == SIGINT || fdsi.ssi_signo == SIGQUIT || fdsi.ssi_signo == SIGTERM) {
+            break;
         }
-
-        /*
-         * Write data buffer to file
-         */
-        write_buffer_to_file(data_buffer);
+        ERR("Caught unknown signal, ignore\n");
+    }
+    FATAL("caught termination signal, exiting...\n");
+    for (auto& server : servers) {
+        server->stop();
     }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    close(sigfd);
+    exit(EXIT_SUCCESS);
 }
-
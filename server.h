@@ -2,74 +2,213 @@
 #define _SERVER_H_
 
 #include "packet.h"
+#include "ring_buffer.h"
+#include "batch_io.h"
+#include "transport.h"
+#include "rtt_estimator.h"
+#include "seq_space.h"
+#include "event_loop.h"
+#include "packet_pool.h"
+#include "fec.h"
+#include "checksum.h"
 
 #include <string>
 #include <vector>
-#include <list>
+#include <unordered_map>
+#include <memory>
 
-#include <poll.h>
+#include <netinet/in.h>
+#include <sys/types.h>
 
-//typedef std::pair<Header, std::vector<char> > DataPacket;
-//typedef std::list<DataPacket> Buffer;
-//typedef Buffer::iterator BuffIter;
+enum SessionState {
+    ESTABLISHED, // SYN-ACK sent, receiving data packets
+    CLOSING      // FIN-ACK sent, waiting for the last ACK
+};
+
+// parity packets of a block whose data packets are not all in yet
+struct FecBlock {
+    uint32_t start; // sequence number of the first data packet
+    int k;          // data packets
+    int count;      // parity packets received
+    uint8_t index[FEC_MAX_PARITY];  // of each parity packet, 0 for the XOR one
+    char* parity[FEC_MAX_PARITY];   // payloads, buffers of the packet pool
+};
+
+// per-client connection state
+struct Session {
+    int client_id;
+    struct sockaddr_in client_addr;
+    SessionState state;
+
+    uint8_t version;     // header version negotiated with SYN / SYN-ACK
+    SeqSpace seq_space;  // sequence numbers of the version
+    bool sack;           // ACK packets report out-of-order data as SACK blocks
+    int max_segment;     // largest segment the client may pick, 0 if it can't negotiate one
+    bool fec;            // the client may send parity packets, see HeaderOptions
+    bool checksum;       // packets after SYN carry a checksum, FIN the digest of the file
+
+    uint32_t seq_number;        // next sequence number of the server
+    uint32_t expect_seq_number; // next expected in-order sequence number
+    uint32_t expect_ack_number; // ACK number which closes the connection (CLOSING only)
+
+    RingBuffer buffer;         // out-of-order packets, slot 0 is the next in-order packet, 
+                               // slots hold a segment
+    int filefd;                // output file, in-order payloads are written as they arrive
+    off_t file_offset;         // file offset of slot 0
+    std::vector<FecBlock> fec_blocks; // blocks waiting for data or parity packets, oldest first
+    uint32_t recovered;        // data packets rebuilt from parity packets, reported in ACKs
+    uint32_t digest;           // CRC32C of the payloads written in order
+    std::unique_ptr<Crc32cShift> slot_shift; // extends the digest by a full slot from the 
+                                             // CRC of its payload, kept by the buffer
+
+    char* out_packet; // latest packet sent (a buffer of the packet pool), resent on 
+                      // retransmission timeout
+    int out_length;
+
+    int retrans_timer; // retransmission timer, in the event loop of the server
+    int timeout_timer; // timeout timer (to close the connection)
+    int ack_timer;     // delayed ACK timer
+    int unacked_packets; // in-order packets received since the last ACK
+
+    RttEstimator rtt;  // retransmission timeout
+    long rtt_probe_us; // time SYN-ACK was sent, -1 once sampled or retransmitted
+
+    Session(int capacity, int slot_size, uint8_t version, const SeqSpace& seq_space, 
+            const RttEstimator& rtt);
+};
+
+// hash and compare clients by IP address and port
+struct AddrHash {
+    size_t operator()(const struct sockaddr_in& addr) const;
+};
+
+struct AddrEqual {
+    bool operator()(const struct sockaddr_in& lhs, const struct sockaddr_in& rhs) const;
+};
+
+typedef std::unordered_map<struct sockaddr_in, Session, AddrHash, AddrEqual> SessionTable;
+
+// receive path of a data packet without acknowledgements, also run by bench/bench_micro.cc: 
+// the packet is stored in its slot, then the in-order packets at the front of the buffer 
+// are written to the file and the expected sequence number moves past them; returns true if 
+// it was the next in-order packet
+bool store_data_packet(Session& session, const char* in_packet, int length, 
+        const ConstHeaderView& in_header, uint32_t payload_crc);
+
+struct ServerOptions {
+    int batch_size; // datagrams per sendmmsg/recvmmsg
+    bool gro;       // accept datagrams coalesced by the kernel (UDP GRO)
+    long min_rto_us; // bounds of the retransmission timeout
+    long max_rto_us;
+    int recv_window;  // bytes buffered per 32-bit connection, advertised in SYN-ACK
+    int workers;      // worker threads, each with its own socket on the port (SO_REUSEPORT)
+    std::string steer; // how the kernel picks the worker of a packet: its own hash of the 
+                       // addresses if empty, "cpu" (receiving CPU) or "hash" (NIC flow hash)
+    std::vector<int> cpus; // CPU of each worker, no affinity if empty
+    int ack_every;     // in-order packets acknowledged together
+    long ack_delay_us; // longest wait for the next in-order packet before acknowledging
+    NetemOptions netem; // impairments of the packets sent, the seed is offset by the worker
+
+    ServerOptions();
+};
 
 class Server {
 public:
     unsigned int port;
-    int max_packet_size;    
-    int max_seq_number;
+    int max_packet_size; // largest datagram, the largest segment plus the 12-byte header
+    int max_seq_number; // sequence space of legacy connections
+    int max_segment;    // largest segment accepted from clients
     
+    int worker; // index of the worker thread
     int sockfd;
-    int sigfd;
-    int retrans_timerfd; // retransmission timer
-    int timeout_timerfd; // timeout timer (to close the connection)
+    std::unique_ptr<Transport> transport; // packets leave the socket through it
+    int sigfd;  // -1 with several workers, the main thread catches signals
+    int stopfd; // eventfd asking a worker to stop, -1 with a single worker
     
-    int client_id; // id of client
+    ServerOptions options;
+    PacketBatch in_batch;  // received packets
+    PacketBatch out_batch; // ACK packets waiting to be sent
+    PacketPool pool;       // out_packet of the sessions and parity packets
+    std::vector<char> fec_scratch; // data packets read back from the file and rebuilt ones
+
+    int next_client_id; // id of next client, workers number clients worker + 1 + k * workers
     
-    struct pollfd fds[4];
+    SessionTable sessions; // all connected clients, keyed by address
+    std::unordered_map<int, struct sockaddr_in> timer_owners; // session of each timer
     
-    struct itimerspec RTO; 
-    struct itimerspec time_out;
+    EventLoop loop; // socket, signal and the timers of all sessions
+    RttEstimator initial_rtt; // retransmission timeout of new sessions
+    long time_out_us;
     
-    Server(int port, int max_packet_size, int max_seq_number);
+    Server(int port, int max_packet_size, int max_seq_number, 
+            const ServerOptions& options = ServerOptions(), int worker = 0);
     
     void listen();
 
+    // ask listen() to give up all sessions and return, may be called from another thread
+    void stop();
+
 private:
-    int write_buffer_to_file(const Buffer& buffer);
+    int open_file(Session& session);
+
+    int write_buffer_to_file(Session& session);
     
-    void write_interrupt_to_file();
+    void write_interrupt_to_file(Session& session, const char* mark);
 
     void release_resources();
     
-    void write_syn_ack_packet(std::vector<char>& packet, Header& header, int& seq_number, 
-            int ack_number);
+    // SYN-ACK packets are written to `packet`, the others to the out_packet of the session
+    int write_syn_ack_packet(const Session& session, char* packet, uint16_t probe);
     
-    void write_ack_packet(std::vector<char>& packet, Header& header, int seq_number, 
-            int ack_number); 
+    void write_ack_packet(Session& session, uint32_t ack_number);
     
-    void write_fin_ack_packet(std::vector<char>& packet, Header& header, int& seq_number, 
-            int ack_number);
+    void write_fin_ack_packet(Session& session, uint32_t ack_number);
+
+    void send_ack(Session& session, bool dup);
 
     //void write_fin_packet(std::vector<char>& packet, Header& header, int& seq_number);
 
-    int recv_data_to_buffer(struct sockaddr_in& client_addr, 
-            std::vector<char>& in_packet, Header& in_header, 
-            std::vector<char>& out_packet, Header& out_header, 
-            std::list<DataPacket>& buffer, int seq_number, int expect_seq_number);
-    
-    void move_iter_forward(Buffer& buffer, BuffIter& inorder_iter, int& ack_number);
-    
-    void insert_packet_to_buffer(Buffer& buffer, BuffIter& inorder_iter, 
-            const std::vector<char>& in_packet, const Header& in_header);
+    void recv_data_to_buffer(Session& session, const char* in_packet, int length,
+            const ConstHeaderView& in_header, uint32_t payload_crc);
     
+    void recv_parity(Session& session, const char* in_packet, int length, 
+            const ConstHeaderView& in_header, const HeaderOptions& header_options);
+
+    bool recover_block(Session& session, const FecBlock& block);
+
+    void recover_data(Session& session, size_t block_idx);
+
+    void release_block(Session& session, size_t block_idx);
+
     void catch_signal();
     
-    void close_connection(struct sockaddr_in& client_addr, std::vector<char>& in_packet, 
-            Header& in_header, std::vector<char>& out_packet, Header& out_header, int seq_number);
+    void shutdown();
 
-    void hand_shaking(struct sockaddr_in& client_addr, std::vector<char>& ack_packet, 
-            Header& ack_header);
+    void set_affinity();
+
+    void close_connection(Session& session, const ConstHeaderView& in_header);
+
+    void hand_shaking(const struct sockaddr_in& client_addr, const char* in_packet, int length, 
+            const ConstHeaderView& in_header);
+
+    void answer_syn(Session& session, const char* in_packet, int length, 
+            const ConstHeaderView& in_header);
+
+    void dispatch_packet(const struct sockaddr_in& client_addr,
+            const char* in_packet, int length, const ConstHeaderView& in_header);
+
+    void retransmission_timeout(Session& session);
+
+    void queue_packet(const struct sockaddr_in& addr, const char* packet, int length);
+
+    void flush_packets();
+
+    void remove_session(SessionTable::iterator it);
+
+    void handle_timer(int timer);
 };
 
+// run options.workers servers on the port until a termination signal
+void serve(int port, int max_packet_size, int max_seq_number, const ServerOptions& options);
+
 #endif
@@ -0,0 +1,151 @@
+#include "timer_wheel.h"
+// C++ headers
+#include <algorithm>
+
+static const uint64_t NO_TICK = UINT64_MAX;
+
+TimerWheel::TimerWheel(long tick_us, long now_us) : tick(tick_us), now_tick(now_us / tick_us) {
+    std::fill(heads, heads + LEVELS * SLOTS, -1);
+    std::fill(occupied, occupied + LEVELS, 0);
+}
+
+int TimerWheel::create() {
+    Timer timer = {0, -1, -1, -1};
+    if (free_timers.empty()) {
+        timers.push_back(timer);
+        return timers.size() - 1;
+    }
+    int id = free_timers.back();
+    free_timers.pop_back();
+    timers[id] = timer;
+    return id;
+}
+
+void TimerWheel::destroy(int timer) {
+    stop(timer);
+    free_timers.push_back(timer);
+}
+
+void TimerWheel::start(int timer, long deadline_us) {
+    stop(timer);
+    // round up, a timer never expires early
+    uint64_t deadline = (deadline_us + tick - 1) / tick;
+    timers[timer].deadline = std::max(deadline, now_tick + 1);
+    link(timer);
+}
+
+void TimerWheel::stop(int timer) {
+    if (timers[timer].slot >= 0) {
+        unlink(timer);
+    }
+}
+
+// put the timer in the lowest level which covers its deadline
+void TimerWheel::link(int timer) {
+    Timer& t = timers[timer];
+    uint64_t limit = ((uint64_t) 1 << (SLOT_BITS * LEVELS)) - 1;
+    uint64_t deadline = std::min(t.deadline, now_tick + limit);
+    uint64_t delta = deadline - now_tick;
+    int level = 0;
+    while (level != LEVELS - 1 && delta >= (uint64_t) 1 << (SLOT_BITS * (level + 1))) {
+        ++level;
+    }
+    int index = (deadline >> (SLOT_BITS * level)) & (SLOTS - 1);
+    int slot = level * SLOTS + index;
+    t.slot = slot;
+    t.prev = -1;
+    t.next = heads[slot];
+    if (t.next >= 0) {
+        timers[t.next].prev = timer;
+    }
+    heads[slot] = timer;
+    occupied[level] |= (uint64_t) 1 << index;
+}
+
+void TimerWheel::unlink(int timer) {
+    Timer& t = timers[timer];
+    if (t.prev >= 0) {
+        timers[t.prev].next = t.next;
+    }
+    else {
+        heads[t.slot] = t.next;
+    }
+    if (t.next >= 0) {
+        timers[t.next].prev = t.prev;
+    }
+    if (heads[t.slot] < 0) {
+        occupied[t.slot / SLOTS] &= ~((uint64_t) 1 << (t.slot % SLOTS));
+    }
+    t.slot = -1;
+}
+
+// the first tick after now_tick at which a slot expires (level 0) or is cascaded
+uint64_t TimerWheel::next_tick() const {
+    uint64_t next = NO_TICK;
+    for (int level = 0; level != LEVELS; ++level) {
+        if (occupied[level] == 0) {
+            continue;
+        }
+        int shift = SLOT_BITS * level;
+        uint64_t position = now_tick >> shift;
+        // slots are visited from position + 1 on, wrapping around
+        int start = (position + 1) & (SLOTS - 1);
+        uint64_t rotated = occupied[level] >> start;
+        if (start != 0) {
+            rotated |= occupied[level] << (SLOTS - start);
+        }
+        uint64_t distance = __builtin_ctzll(rotated) + 1;
+        next = std::min(next, (position + distance) << shift);
+    }
+    return next;
+}
+
+long TimerWheel::next_deadline_us() const {
+    uint64_t next = next_tick();
+    return next == NO_TICK ? -1 : (long) (next * tick);
+}
+
+// move the timers of the current slot of a level to lower levels
+void TimerWheel::cascade(int level) {
+    int slot = level * SLOTS + ((now_tick >> (SLOT_BITS * level)) & (SLOTS - 1));
+    int timer = heads[slot];
+    heads[slot] = -1;
+    occupied[level] &= ~((uint64_t) 1 << (slot % SLOTS));
+    while (timer >= 0) {
+        int next = timers[timer].next;
+        link(timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::expire(std::vector<int>& expired) {
+    int slot = now_tick & (SLOTS - 1);
+    int timer = heads[slot];
+    heads[slot] = -1;
+    occupied[0] &= ~((uint64_t) 1 << slot);
+    while (timer >= 0) {
+        int next = timers[timer].next;
+        timers[timer].slot = -1;
+        expired.push_back(timer);
+        timer = next;
+    }
+}
+
+void TimerWheel::advance(long now_us, std::vector<int>& expired) {
+    uint64_t target = now_us / tick;
+    while (now_tick < target) {
+        // jump over the ticks where nothing happens
+        uint64_t next = next_tick();
+        if (next > target) {
+            now_tick = target;
+            break;
+        }
+        now_tick = next;
+        for (int level = LEVELS - 1; level != 0; --level) {
+            if ((now_tick & (((uint64_t) 1 << (SLOT_BITS * level)) - 1)) == 0) {
+                cascade(level);
+            }
+        }
+        expire(expired);
+    }
+}
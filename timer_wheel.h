@@ -0,0 +1,72 @@
+#ifndef _TIMER_WHEEL_H_
+#define _TIMER_WHEEL_H_
+
+#include <vector>
+#include <cstdint>
+
+// Hierarchical timing wheel: LEVELS wheels of SLOTS slots, slot i of level l holds the timers
+// which expire during the i-th (mod SLOTS) SLOTS^l ticks. Timers are kept in intrusive doubly
+// linked lists, so starting and stopping one is O(1) whatever the number of timers. When the
+// lowest wheel wraps around, the next slot of the level above is cascaded down. Deadlines are
+// rounded up to whole ticks, timers further than SLOTS^LEVELS ticks away are cascaded again 
+// until they are in range.
+class TimerWheel {
+public:
+    static const int SLOT_BITS = 6;
+    static const int SLOTS = 1 << SLOT_BITS;
+    static const int LEVELS = 4;
+
+    TimerWheel(long tick_us, long now_us);
+
+    TimerWheel(const TimerWheel&) = delete;
+
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    // stopped timer, ids are reused after destroy()
+    int create();
+
+    void destroy(int timer);
+
+    // (re)start the timer to expire at deadline_us
+    void start(int timer, long deadline_us);
+
+    void stop(int timer);
+
+    bool active(int timer) const { return timers[timer].slot >= 0; }
+
+    // move the wheel to now_us, appending the timers which expired to `expired`
+    void advance(long now_us, std::vector<int>& expired);
+
+    // time of the next expiration or cascade, when advance() should be called next; -1 if 
+    // no timer is active
+    long next_deadline_us() const;
+
+    long tick_us() const { return tick; }
+
+private:
+    struct Timer {
+        uint64_t deadline; // in ticks
+        int slot;          // -1 if stopped
+        int prev;
+        int next;
+    };
+
+    long tick;
+    uint64_t now_tick; // ticks up to now_tick are processed
+    std::vector<Timer> timers;
+    std::vector<int> free_timers;
+    int heads[LEVELS * SLOTS];  // first timer of each slot, -1 if empty
+    uint64_t occupied[LEVELS];  // non-empty slots of each level
+
+    void link(int timer);
+
+    void unlink(int timer);
+
+    uint64_t next_tick() const;
+
+    void cascade(int level);
+
+    void expire(std::vector<int>& expired);
+};
+
+#endif
@@ -0,0 +1,300 @@
+#include "transport.h"
+#include "packet.h"
+#include "utils.h"
+// C headers
+#include <cstdlib>
+#include <cstring>
+// C++ headers
+#include <algorithm>
+#include <chrono>
+// LINUX headers
+#include <sys/socket.h>
+
+int Transport::send(const struct sockaddr_in& addr, const char* packet, int length) {
+    return sendto(sockfd, packet, length, 0, (const struct sockaddr*) &addr, sizeof(addr));
+}
+
+NetemOptions::NetemOptions() : loss(0), ge_p(0), ge_r(1), ge_bad_loss(1), ge_good_loss(0),
+    delay_us(0), jitter_us(0), reorder(0), duplicate(0), corrupt(0), rate(0), limit(1000), mtu(0),
+    seed(1) {
+}
+
+bool NetemOptions::enabled() const {
+    return loss > 0 || ge_p > 0 || delay_us > 0 || jitter_us > 0 || duplicate > 0
+        || corrupt > 0 || rate > 0 || mtu > 0;
+}
+
+// "1%" or "1" is 0.01
+static bool parse_probability(const std::string& value, double& probability) {
+    char* end;
+    double percent = strtod(value.c_str(), &end);
+    if (end == value.c_str() || (*end != '\0' && std::string(end) != "%")
+            || percent < 0 || percent > 100) {
+        return false;
+    }
+    probability = percent / 100;
+    return true;
+}
+
+static bool parse_time(const std::string& value, long& time_us) {
+    char* end;
+    double time = strtod(value.c_str(), &end);
+    std::string unit(end);
+    if (end == value.c_str() || time < 0) {
+        return false;
+    }
+    if (unit == "us") {
+        time_us = (long) time;
+    }
+    else if (unit == "ms" || unit.empty()) {
+        time_us = (long) (time * 1000);
+    }
+    else if (unit == "s") {
+        time_us = (long) (time * 1000000);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// bits per second to bytes per second
+static bool parse_rate(const std::string& value, long& rate) {
+    char* end;
+    double bits = strtod(value.c_str(), &end);
+    std::string unit(end);
+    if (end == value.c_str() || bits <= 0) {
+        return false;
+    }
+    if (unit == "kbit") {
+        bits *= 1e3;
+    }
+    else if (unit == "mbit") {
+        bits *= 1e6;
+    }
+    else if (unit == "gbit") {
+        bits *= 1e9;
+    }
+    else if (unit != "bit") {
+        return false;
+    }
+    rate = std::max(1L, (long) (bits / 8));
+    return true;
+}
+
+static bool parse_gemodel(const std::string& value, NetemOptions& options) {
+    std::vector<double> params;
+    for (size_t pos = 0; pos != std::string::npos;) {
+        size_t colon = value.find(':', pos);
+        double param;
+        if (!parse_probability(value.substr(pos, colon - pos), param)) {
+            return false;
+        }
+        params.push_back(param);
+        pos = colon == std::string::npos ? colon : colon + 1;
+    }
+    if (params.size() > 4) {
+        return false;
+    }
+    // defaults of netem: r = 1 - p, every packet lost in the bad state, none in the good one
+    options.ge_p = params[0];
+    options.ge_r = params.size() > 1 ? params[1] : 1 - params[0];
+    options.ge_bad_loss = params.size() > 2 ? params[2] : 1;
+    options.ge_good_loss = params.size() > 3 ? params[3] : 0;
+    return true;
+}
+
+bool parse_netem(const std::string& spec, NetemOptions& options) {
+    for (size_t pos = 0; pos != std::string::npos;) {
+        size_t comma = spec.find(',', pos);
+        std::string item = spec.substr(pos, comma - pos);
+        pos = comma == std::string::npos ? comma : comma + 1;
+        size_t equal = item.find('=');
+        if (equal == std::string::npos) {
+            return false;
+        }
+        std::string name = item.substr(0, equal);
+        std::string value = item.substr(equal + 1);
+        bool valid;
+        if (name == "loss") {
+            valid = parse_probability(value, options.loss);
+        }
+        else if (name == "gemodel") {
+            valid = parse_gemodel(value, options);
+        }
+        else if (name == "delay") {
+            valid = parse_time(value, options.delay_us);
+        }
+        else if (name == "jitter") {
+            valid = parse_time(value, options.jitter_us);
+        }
+        else if (name == "reorder") {
+            valid = parse_probability(value, options.reorder);
+        }
+        else if (name == "duplicate") {
+            valid = parse_probability(value, options.duplicate);
+        }
+        else if (name == "corrupt") {
+            valid = parse_probability(value, options.corrupt);
+        }
+        else if (name == "rate") {
+            valid = parse_rate(value, options.rate);
+        }
+        else if (name == "limit") {
+            options.limit = std::atoi(value.c_str());
+            valid = options.limit > 0;
+        }
+        else if (name == "mtu") {
+            options.mtu = std::atoi(value.c_str());
+            valid = options.mtu > UDP_IP_OVERHEAD;
+        }
+        else if (name == "seed") {
+            options.seed = strtoul(value.c_str(), NULL, 10);
+            valid = !value.empty();
+        }
+        else {
+            valid = false;
+        }
+        if (!valid) {
+            return false;
+        }
+    }
+    return true;
+}
+
+NetEmulator::NetEmulator(int sockfd, const NetemOptions& options, int max_packet_size)
+    : Transport(sockfd), options(options), random(options.seed), bad_state(false),
+    link_free_us(0), next_order(0), sent(0), lost(0), overflowed(0), duplicated(0),
+    reordered(0), corrupted(0), corrupt_copy(max_packet_size), pool(max_packet_size, 64), 
+    stopping(false) {
+    // without delay and bandwidth every datagram is due when it is sent
+    if (options.delay_us > 0 || options.jitter_us > 0 || options.rate > 0) {
+        sender = std::thread(&NetEmulator::send_loop, this);
+    }
+}
+
+NetEmulator::~NetEmulator() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wakeup.notify_one();
+    if (sender.joinable()) {
+        sender.join();
+    }
+    INFO("netem: %ld sent, %ld lost, %ld dropped by the link queue, %ld duplicated, "
+            "%ld reordered, %ld corrupted\n", sent, lost, overflowed, duplicated, reordered, 
+            corrupted);
+}
+
+// in [0, 1), the same on every platform for a seed
+double NetEmulator::uniform() {
+    return (random() >> 11) * (1.0 / (1ULL << 53));
+}
+
+bool NetEmulator::lose() {
+    if (options.ge_p > 0) {
+        // the state changes before each packet
+        bad_state = bad_state ? uniform() >= options.ge_r : uniform() < options.ge_p;
+        if (uniform() < (bad_state ? options.ge_bad_loss : options.ge_good_loss)) {
+            return true;
+        }
+    }
+    return options.loss > 0 && uniform() < options.loss;
+}
+
+int NetEmulator::transmit(const struct sockaddr_in& addr, const char* packet, int length,
+        long now) {
+    long depart_us = now;
+    if (options.rate > 0) {
+        while (!departures.empty() && departures.front() <= now) {
+            departures.pop_front();
+        }
+        if ((int) departures.size() >= options.limit) {
+            ++overflowed;
+            return length;
+        }
+        // the datagram leaves once the link has serialized it and everything before it
+        long bytes = length + UDP_IP_OVERHEAD;
+        depart_us = std::max(now, link_free_us) + bytes * 1000000 / options.rate;
+        link_free_us = depart_us;
+        departures.push_back(depart_us);
+    }
+    long due_us = depart_us;
+    if (options.delay_us > 0 && options.reorder > 0 && uniform() < options.reorder) {
+        ++reordered;
+    }
+    else {
+        due_us += options.delay_us;
+        if (options.jitter_us > 0) {
+            due_us += (long) ((2 * uniform() - 1) * options.jitter_us);
+        }
+        due_us = std::max(due_us, depart_us);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    if (due_us <= now && delayed.empty()) {
+        lock.unlock();
+        return Transport::send(addr, packet, length);
+    }
+    Delayed item;
+    item.due_us = due_us;
+    item.order = next_order++;
+    item.addr = addr;
+    item.packet = pool.acquire();
+    item.length = length;
+    memcpy(item.packet, packet, length);
+    delayed.push(item);
+    bool first = delayed.top().order == item.order;
+    lock.unlock();
+    if (first) {
+        wakeup.notify_one();
+    }
+    return length;
+}
+
+int NetEmulator::send(const struct sockaddr_in& addr, const char* packet, int length) {
+    ++sent;
+    if ((options.mtu > 0 && length + UDP_IP_OVERHEAD > options.mtu) || lose()) {
+        // the network takes the datagram as if it left
+        ++lost;
+        return length;
+    }
+    if (options.corrupt > 0 && uniform() < options.corrupt && length > 0 
+            && length <= (int) corrupt_copy.size()) {
+        ++corrupted;
+        memcpy(corrupt_copy.data(), packet, length);
+        long bit = (long) (uniform() * length * 8);
+        corrupt_copy[bit / 8] ^= 1 << (bit % 8);
+        packet = corrupt_copy.data();
+    }
+    long now = now_us();
+    int result = transmit(addr, packet, length, now);
+    if (options.duplicate > 0 && uniform() < options.duplicate) {
+        ++duplicated;
+        transmit(addr, packet, length, now);
+    }
+    return result;
+}
+
+void NetEmulator::send_loop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!stopping) {
+        if (delayed.empty()) {
+            wakeup.wait(lock);
+            continue;
+        }
+        long wait_us = delayed.top().due_us - now_us();
+        if (wait_us > 0) {
+            wakeup.wait_for(lock, std::chrono::microseconds(wait_us));
+            continue;
+        }
+        Delayed item = delayed.top();
+        delayed.pop();
+        lock.unlock();
+        // errors are losses of the emulated network
+        Transport::send(item.addr, item.packet, item.length);
+        lock.lock();
+        pool.release(item.packet);
+    }
+}
@@ -0,0 +1,138 @@
+#ifndef _TRANSPORT_H_
+#define _TRANSPORT_H_
+
+#include "packet_pool.h"
+#include "ring_queue.h"
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <random>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <cstdint>
+#include <netinet/in.h>
+
+// Outgoing datagrams leave the socket through a Transport, incoming ones are read from fd()
+// directly. The base class sends straight to the socket.
+class Transport {
+public:
+    explicit Transport(int sockfd) : sockfd(sockfd) {}
+
+    virtual ~Transport() {}
+
+    Transport(const Transport&) = delete;
+
+    Transport& operator=(const Transport&) = delete;
+
+    int fd() const { return sockfd; }
+
+    // send one datagram, returns its length or -1
+    virtual int send(const struct sockaddr_in& addr, const char* packet, int length);
+
+    // whether datagrams may be handed to the socket in batches (sendmmsg, GSO), otherwise
+    // they must go through send() one by one
+    virtual bool batched() const { return true; }
+
+protected:
+    int sockfd;
+};
+
+// impairments of the emulated link, probabilities are in [0, 1]
+struct NetemOptions {
+    double loss;        // random loss
+    double ge_p;        // Gilbert-Elliott burst loss: good to bad state, 0 disables the model
+    double ge_r;        // bad to good state
+    double ge_bad_loss; // loss in the bad state (1-h)
+    double ge_good_loss;// loss in the good state (1-k)
+    long delay_us;      // one-way delay
+    long jitter_us;     // uniform variation of the delay, up to +/- jitter_us
+    double reorder;     // packets sent without the delay, so they overtake the others
+    double duplicate;   // packets sent twice
+    double corrupt;     // packets with a bit flipped
+    long rate;          // bandwidth in bytes per second, 0 is unlimited
+    int limit;          // packets waiting for the bandwidth before the link drops them
+    int mtu;            // larger IP datagrams are silently dropped (a black hole), 0 is none
+    unsigned long seed; // random decisions repeat with the same seed
+
+    NetemOptions();
+
+    bool enabled() const;
+};
+
+// parse comma separated impairments, e.g. "loss=1%,delay=20ms,jitter=5ms,rate=100mbit":
+//   loss=P%  gemodel=P%:R%[:1-H%[:1-K%]]  delay=T  jitter=T  reorder=P%  duplicate=P%
+//   corrupt=P%  rate=Nbit|Nkbit|Nmbit|Ngbit  limit=N  mtu=N  seed=N
+// times take us, ms (the default) or s; false on an invalid spec
+bool parse_netem(const std::string& spec, NetemOptions& options);
+
+// Network emulator in front of the socket, in the spirit of netem. Each datagram sent may be
+// lost (randomly or in Gilbert-Elliott bursts), corrupted (one bit flipped), duplicated,
+// queued behind the bandwidth of the link (drop-tail beyond `limit` packets), then delayed
+// with jitter; reordered packets skip the delay. Datagrams due now are sent by the caller,
+// the others are copied and sent at their time by a background thread. Only outgoing
+// datagrams are emulated, so each end impairs its own direction.
+class NetEmulator : public Transport {
+public:
+    NetEmulator(int sockfd, const NetemOptions& options, int max_packet_size);
+
+    // stop the background thread, datagrams still on the link are lost
+    ~NetEmulator();
+
+    int send(const struct sockaddr_in& addr, const char* packet, int length) override;
+
+    bool batched() const override { return false; }
+
+private:
+    struct Delayed {
+        long due_us;
+        uint64_t order; // datagrams due at the same time leave in order
+        struct sockaddr_in addr;
+        char* packet;   // buffer of the pool
+        int length;
+    };
+
+    struct Later {
+        bool operator()(const Delayed& lhs, const Delayed& rhs) const {
+            return lhs.due_us != rhs.due_us ? lhs.due_us > rhs.due_us : lhs.order > rhs.order;
+        }
+    };
+
+    NetemOptions options;
+    std::mt19937_64 random;
+    bool bad_state;              // state of the Gilbert-Elliott model
+    long link_free_us;           // when the link is done with the queued datagrams
+    RingQueue<long> departures;  // departure time of the datagrams queued on the link
+    uint64_t next_order;
+
+    // counters, printed when the emulator is destroyed
+    long sent;
+    long lost;
+    long overflowed;
+    long duplicated;
+    long reordered;
+    long corrupted;
+
+    std::vector<char> corrupt_copy; // datagram with a flipped bit
+
+    // shared with the background thread
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    std::priority_queue<Delayed, std::vector<Delayed>, Later> delayed;
+    PacketPool pool;
+    bool stopping;
+    std::thread sender;
+
+    double uniform();
+
+    bool lose();
+
+    // one copy of the datagram through the link, returns the result of send() if it is sent
+    // now, the length otherwise
+    int transmit(const struct sockaddr_in& addr, const char* packet, int length, long now);
+
+    void send_loop();
+};
+
+#endif
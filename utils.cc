@@ -1,14 +1,16 @@
 #include "utils.h"
 #include "packet.h"
+#include "event_log.h"
 #include <cstring>
 #include <cstdio>
 #include <cassert>
 #include <cstdarg>
+#include <ctime>
 #include <string>
 #include <vector>
 #include <algorithm>
 
-#include <sys/timerfd.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,107 +21,87 @@ void print_sys_error(const std::string& extra_info) {
     ERR("ERROR: %s\n", buffer);
 }
 
+// match command line option `--name=value` (or `--name`, leaving value empty)
+bool parse_option(const std::string& arg, const std::string& name, std::string& value) {
+    std::string prefix = "--" + name;
+    if (arg.compare(0, prefix.size(), prefix) != 0) {
+        return false;
+    }
+    if (arg.size() == prefix.size()) {
+        value.clear();
+        return true;
+    }
+    if (arg[prefix.size()] != '=') {
+        return false;
+    }
+    value = arg.substr(prefix.size() + 1);
+    return true;
+}
+
+// monotonic clock in microseconds
+long now_us() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
 
-void reset_timer(int timerfd, const struct itimerspec& new_time) {
-    if (timerfd_settime(timerfd, 0, &new_time, NULL) != 0) {
-        print_sys_error("Unable to reset timer");
-        exit(EXIT_FAILURE);
+static EventLog* event_log = NULL;
+
+static void close_event_log() {
+    if (event_log != NULL) {
+        event_log->close();
+    }
+}
+
+int open_event_log(const std::string& path) {
+    event_log = new EventLog(1 << 16);
+    if (event_log->open(path) == -1) {
+        delete event_log;
+        event_log = NULL;
+        return -1;
     }
+    atexit(close_event_log);
+    return 0;
 }
 
 // print log according to format:
 // RECV <SeqNum> <AckNum> <cwnd> <ssthresh> [ACK] [SYN] [FIN]
 // SEND <SeqNum> <AckNum> <cwnd> <ssthresh> [ACK] [SYN] [FIN] [DUP]
-void print_log(const std::string& prefix, const Header& header, int cwnd, int ssthresh, bool dup) {
-    std::string state = "";
-    if (header.ack) {
-        state = "ACK";
-    }
-    if (header.syn) {
-        state = state + " SYN";
-    }
-    else if (header.fin) {
-        state = state + " FIN";
+// or record it in the event log, see decode_log for the text
+void print_log(const char* prefix, const Header& header, int cwnd, int ssthresh, bool dup) {
+    bool send = prefix[0] == 'S'; // SEND or RECV
+    assert (send || !dup);
+    LogRecord record = make_log_record(send ? LOG_SEND : LOG_RECV, header, cwnd, ssthresh, dup, 
+            now_us());
+    if (event_log != NULL) {
+        event_log->append(record);
+        return;
     }
-    std::string format;
-    if (dup) {
-        assert (prefix == "SEND");
-        format = "%s %d %d %d %d %s DUP\n";
-    } 
-    else {
-        format = "%s %d %d %d %d %s\n";   
-    }
-    INFO(format.c_str(), prefix.c_str(), header.seq_number, header.ack_number, 
-            cwnd, ssthresh, state.c_str());
+    char line[128];
+    format_log_record(record, line, sizeof(line));
+    INFO("%s", line);
 }
 
-void print_log_from_packet(const std::string& prefix, const std::vector<char>& packet, int cwnd, 
-        int ssthresh, bool dup) {
-    Header header;
-    memcpy(&header, packet.data(), sizeof(Header));
-    print_log(prefix, header, cwnd, ssthresh, dup);
+void print_log_from_packet(const char* prefix, const char* packet, int cwnd, int ssthresh, 
+        bool dup) {
+    print_log(prefix, ConstHeaderView(packet).header(), cwnd, ssthresh, dup);
 }
 
-int recv_packet(int sockfd, struct sockaddr_in& addr, std::vector<char>& packet, Header& header, 
-        int max_packet_size) {
+int recv_packet(int sockfd, struct sockaddr_in& addr, char* packet, int max_packet_size) {
     // receive all data
-    packet.resize(max_packet_size);
     socklen_t addr_size = sizeof(addr);
-    int actual_size = recvfrom(sockfd, packet.data(), max_packet_size, MSG_WAITALL, 
+    int actual_size = recvfrom(sockfd, packet, max_packet_size, MSG_WAITALL, 
             (struct sockaddr*) &addr, &addr_size);
-    if (actual_size < 0) {
-        // timeout
+    if (actual_size < 0 || !header_complete(packet, actual_size)) {
+        // timeout, or no header
         return -1;
     }
-    packet.resize(actual_size);
-    // write header
-    memcpy(&header, packet.data(), sizeof(header));
-    return 0;
-
+    return actual_size;
 }
 
-int send_packet(int socketfd, const struct sockaddr_in& addr, const std::vector<char>& packet) {
-    return sendto(socketfd, packet.data(), packet.size(), 0, 
-            (const struct sockaddr*) &addr, sizeof(addr));
-}
-
-void print_buffer(const Buffer& buffer) {
-    int init_seq = -1;
-    int payload = 0;
-    bool error = false;
-    int count = 20 > buffer.size() ? buffer.size() : 20;
-    auto it = std::prev(buffer.end(), count);
-    for (; it != buffer.end(); ++it) {
-        DEBUG("(%d)->", it->first.seq_number);
-        if (init_seq >= 0) {
-            int expect = (init_seq + payload) % 25600;
-            int actual = it->first.seq_number;
-            if (it->first.seq_number < expect - 25600 / 2)
-                actual += 25600;
-            if (actual < expect)
-                error = true;
-        }
-        init_seq = it->first.seq_number;
-        payload = it->second.size() - sizeof(Header);
-    }
-    /*
-    for (auto e : buffer) {
-        DEBUG("(%d)->", e.first.seq_number);
-        if (init_seq >= 0) {
-            int expect = (init_seq + payload) % 25600;
-            int actual = e.first.seq_number;
-            if (e.first.seq_number < expect - 25600 / 2)
-                actual += 25600;
-            if (actual < expect)
-                error = true;
-        }
-        init_seq = e.first.seq_number;
-        payload = e.second.size() - sizeof(Header);
-    }
-    */
-    DEBUG("ENDL\n");
-    if (error)
-        exit(EXIT_FAILURE);
+int send_packet(Transport& transport, const struct sockaddr_in& addr, const char* packet, 
+        int length) {
+    return transport.send(addr, packet, length);
 }
 
 void debug(const char* fmt, ...) {
@@ -152,6 +134,3 @@ void fatal(const char* fmt, ...) {
     vfprintf(stderr, fmt, arglist);
     va_end(arglist);
 }
-void nop(const char* fmt, ...) {
-    // do nothing
-}
@@ -1,39 +1,66 @@
 #ifndef _UTILS_H_
 #define _UTILS_H_
 #include "packet.h"
+#include "transport.h"
 #include <string>
 #include <vector>
-#include <sys/timerfd.h>
 
 
-#define DEBUG(fmt, ...) nop((fmt), ##__VA_ARGS__); 
-#define INFO(fmt, ...) info((fmt), ##__VA_ARGS__);
-#define ERR(fmt, ...) err((fmt), ##__VA_ARGS__);
-#define FATAL(fmt, ...) fatal((fmt), ##__VA_ARGS__);
+// Log levels. Levels below LOG_LEVEL are compiled out: the macros keep the call behind a 
+// constant false condition, so neither the call nor its arguments are evaluated (and the
+// compiler drops the code), while the format string is still type-checked. SEND/RECV logs
+// (PRINT_LOG) are at the INFO level. Build with e.g. -DLOG_LEVEL=LOG_LEVEL_DEBUG.
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_ERR 2
+#define LOG_LEVEL_FATAL 3
+#define LOG_LEVEL_NONE 4
+
+#ifndef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_AT(level, call) do { if (LOG_LEVEL <= (level)) { call; } } while (0)
+
+#define DEBUG(fmt, ...) LOG_AT(LOG_LEVEL_DEBUG, debug((fmt), ##__VA_ARGS__))
+#define INFO(fmt, ...) LOG_AT(LOG_LEVEL_INFO, info((fmt), ##__VA_ARGS__))
+#define ERR(fmt, ...) LOG_AT(LOG_LEVEL_ERR, err((fmt), ##__VA_ARGS__))
+#define FATAL(fmt, ...) LOG_AT(LOG_LEVEL_FATAL, fatal((fmt), ##__VA_ARGS__))
+
+#define PRINT_LOG(prefix, header, cwnd, ssthresh, dup) \
+    LOG_AT(LOG_LEVEL_INFO, print_log((prefix), (header), (cwnd), (ssthresh), (dup)))
+#define PRINT_LOG_FROM_PACKET(prefix, packet, cwnd, ssthresh, dup) \
+    LOG_AT(LOG_LEVEL_INFO, print_log_from_packet((prefix), (packet), (cwnd), (ssthresh), (dup)))
 
 void print_sys_error(const std::string& extra_info);
 
-void reset_timer(int timerfd, const struct itimerspec& new_time);
+bool parse_option(const std::string& arg, const std::string& name, std::string& value);
 
-int recv_packet(int sockfd, struct sockaddr_in& addr, std::vector<char>& packet, Header& header, int max_packet_size);
+long now_us();
 
-int send_packet(int socketfd, const struct sockaddr_in& addr, const std::vector<char>& packet);
+// receive one packet into a buffer of max_packet_size bytes, returns its length or -1 (also 
+// if it is shorter than the header)
+int recv_packet(int sockfd, struct sockaddr_in& addr, char* packet, int max_packet_size);
 
-void print_log(const std::string& prefix, const Header& header, int cwnd, int ssthresh, bool dup);
+// send one packet through the transport of the socket
+int send_packet(Transport& transport, const struct sockaddr_in& addr, const char* packet, 
+        int length);
 
-void print_log_from_packet(const std::string& prefix, const std::vector<char>& packet, int cwnd, 
-        int ssthresh, bool dup);
+// send SEND/RECV logs to a binary event log file instead of stdout, it is written in the 
+// background and completed at exit, -1 on error
+int open_event_log(const std::string& path);
 
-void print_buffer(const Buffer& buffer);
+void print_log(const char* prefix, const Header& header, int cwnd, int ssthresh, bool dup);
 
-void debug(const char* fmt, ...);
+void print_log_from_packet(const char* prefix, const char* packet, int cwnd, int ssthresh, 
+        bool dup);
 
-void info(const char* fmt, ...);
+void debug(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 
-void err(const char* fmt, ...);
+void info(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 
-void fatal(const char* fmt, ...);
+void err(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 
-void nop(const char* fmt, ...);
+void fatal(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
 
 #endif